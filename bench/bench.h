@@ -0,0 +1,52 @@
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BENCH_H_INCLUDED
+#define BENCH_H_INCLUDED
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define EH_HAVE_TSC 1
+#endif
+
+// Results are added here so that the compiler keeps the timed work.
+extern volatile uint64_t benchSink;
+
+struct Timing {
+    double ns;
+    double cycles;
+};
+
+// Cycles are read from the time stamp counter, which ticks at a fixed rate
+// rather than at the core clock; they are 0 where there is none.
+inline uint64_t Cycles()
+{
+#ifdef EH_HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// Runs f in doubling batches until one batch takes at least minNs, and
+// returns the time of one call in that batch.
+template<typename F>
+Timing Time(F f, double minNs)
+{
+    for (size_t iterations = 1; ; iterations *= 2) {
+        auto start = std::chrono::steady_clock::now();
+        uint64_t startCycles = Cycles();
+        for (size_t i = 0; i < iterations; i++)
+            f();
+        uint64_t cycles = Cycles() - startCycles;
+        std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+        if (elapsed.count() >= minNs || iterations >= (size_t(1) << 40))
+            return Timing {elapsed.count() / iterations, double(cycles) / iterations};
+    }
+}
+
+#endif
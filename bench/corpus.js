@@ -0,0 +1,122 @@
+// Replays a share corpus (the format is described in corpusbench.cpp)
+// through the Node binding, checks every verdict against the one recorded
+// for it, and reports shares per second for each parameter set: over its
+// valid shares, over its invalid ones, and for each class of invalid share.
+//
+//   node bench/corpus.js [corpus [milliseconds per mix]]
+//
+// With 0 milliseconds it only checks the verdicts, which is what npm test
+// runs. Either way it exits with 1 if any verdict differs.
+
+var fs = require('fs');
+var path = require('path');
+var ev = require('../index.js');
+
+// EhReason and the corpus classes, by value.
+var REASONS = ['valid', 'badLength', 'aboveTarget', 'indexOrder', 'duplicateIndex', 'collision', 'nonZeroFinal'];
+var CLASSES = ['valid', 'indexOrder', 'duplicateIndex', 'collision', 'personalization', 'badLength'];
+
+var file = process.argv[2] || path.join(__dirname, 'corpus.bin');
+var minMs = Number(process.argv[3] || 200);
+
+function describe(reason, round) {
+	return reason === 'collision' ? reason + '@' + round : reason;
+}
+
+function parseCorpus(bytes) {
+	if (bytes.length < 16 || bytes.toString('latin1', 0, 8) !== 'EHCORPUS' || bytes.readUInt32LE(8) !== 1)
+		throw new Error(file + ' is not a version 1 corpus');
+	var count = bytes.readUInt32LE(12);
+	var records = [];
+	var pos = 16;
+	for (var i = 0; i < count; i++) {
+		var personalization = bytes.slice(pos + 6, pos + 14).toString('latin1').replace(/\0+$/, '');
+		var solutionLength = bytes.readUInt16LE(pos + 154);
+		var record = {
+			n: bytes.readUInt16LE(pos),
+			k: bytes[pos + 2],
+			cls: CLASSES[bytes[pos + 3]],
+			expected: describe(REASONS[bytes[pos + 4]], bytes[pos + 5]),
+			personalization: personalization,
+			header: bytes.slice(pos + 14, pos + 154),
+			solution: bytes.slice(pos + 156, pos + 156 + solutionLength)
+		};
+		record.label = record.cls === 'collision' ? record.expected : record.cls;
+		records.push(record);
+		pos += 156 + solutionLength;
+	}
+	if (pos !== bytes.length)
+		throw new Error(file + ' is truncated or has trailing bytes');
+	return records;
+}
+
+// Replays shares in doubling rounds until one round takes at least minMs.
+function sharesPerSecond(shares) {
+	for (var rounds = 1; ; rounds *= 2) {
+		var start = process.hrtime();
+		for (var r = 0; r < rounds; r++) {
+			for (var i = 0; i < shares.length; i++)
+				shares[i].verifier.check(shares[i].header, shares[i].solution);
+		}
+		var elapsed = process.hrtime(start);
+		var ms = elapsed[0] * 1e3 + elapsed[1] / 1e6;
+		if (ms >= minMs)
+			return rounds * shares.length / (ms / 1e3);
+	}
+}
+
+function report(mix, shares) {
+	if (shares.length === 0)
+		return;
+	var rate = sharesPerSecond(shares);
+	console.log('  ' + mix.padEnd(18) + String(shares.length).padStart(7) +
+		rate.toFixed(0).padStart(15) + (1e9 / rate).toFixed(1).padStart(13));
+}
+
+var records = parseCorpus(fs.readFileSync(file));
+
+// One verifier per parameter set and personalization, without a share
+// cache: replayed shares must be verified every time.
+var verifiers = {};
+var sets = [];
+var failures = 0;
+records.forEach(function (record) {
+	var set = record.n + ',' + record.k;
+	var id = set + ' ' + record.personalization;
+	if (!verifiers[id])
+		verifiers[id] = ev.createVerifier({n: record.n, k: record.k, personalization: record.personalization, cacheSize: 0});
+	record.verifier = verifiers[id];
+	if (sets.indexOf(set) < 0)
+		sets.push(set);
+
+	var result = record.verifier.check(record.header, record.solution);
+	var got = describe(result.reason, result.round);
+	if (got !== record.expected) {
+		console.error(id + ' ' + record.label + ' share: got ' + got + ', expected ' + record.expected);
+		failures++;
+	}
+});
+
+if (minMs === 0)
+	console.log(records.length + ' shares, ' + failures + ' failed');
+
+sets.forEach(function (set) {
+	if (minMs === 0)
+		return;
+	var shares = records.filter(function (record) { return record.n + ',' + record.k === set; });
+	var labels = [];
+	shares.forEach(function (record) {
+		if (record.cls !== 'valid' && labels.indexOf(record.label) < 0)
+			labels.push(record.label);
+	});
+
+	console.log(set);
+	console.log('  ' + 'mix'.padEnd(18) + 'shares'.padStart(7) + 'shares/s'.padStart(15) + 'ns/share'.padStart(13));
+	report('valid', shares.filter(function (record) { return record.cls === 'valid'; }));
+	report('invalid', shares.filter(function (record) { return record.cls !== 'valid'; }));
+	labels.forEach(function (label) {
+		report('  ' + label, shares.filter(function (record) { return record.label === label; }));
+	});
+});
+
+process.exitCode = failures ? 1 : 0;
@@ -0,0 +1,196 @@
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Replays a share corpus through EhVerifier, checks every verdict against
+// the one recorded for it, and reports shares per second for each
+// parameter set: over its valid shares, over its invalid ones, and for each
+// class of invalid share, since those stop at different depths.
+//
+//   corpusbench [corpus [milliseconds per mix]]
+//
+// The corpus is little-endian:
+//
+//   "EHCORPUS", uint32 version (1), uint32 record count
+//   per record:
+//     uint16 n, uint8 k, uint8 class (see ClassNames),
+//     uint8 expected EhReason, uint8 expected round (collisions only),
+//     8 bytes personalization, zero padded,
+//     140 bytes header, uint16 solution length, solution
+//
+// bench/corpus.js replays the same file through the Node binding.
+
+#include "bench.h"
+#include "verifier.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+volatile uint64_t benchSink;
+
+namespace {
+
+const char* const ClassNames[] = {
+    "valid", "indexOrder", "duplicateIndex", "collision", "personalization", "badLength",
+};
+enum : unsigned int { ClassCount=sizeof(ClassNames)/sizeof(ClassNames[0]) };
+
+struct Record {
+    unsigned int n, k;
+    unsigned int cls;
+    EhResult expected;
+    std::string personalization;
+    const CBlockHeader* header;
+    const char* soln;
+    size_t solnLen;
+    const EhVerifier* verifier;
+};
+
+unsigned int ReadLE(const unsigned char* p, size_t bytes)
+{
+    unsigned int value = 0;
+    for (size_t i = bytes; i > 0; i--)
+        value = (value << 8) | p[i-1];
+    return value;
+}
+
+bool ParseCorpus(const std::vector<unsigned char>& bytes, std::vector<Record>& records)
+{
+    const size_t RecordHead = 6 + EhPersonalizationLength + sizeof(CBlockHeader) + 2;
+    if (bytes.size() < 16 || memcmp(bytes.data(), "EHCORPUS", 8) != 0 ||
+            ReadLE(&bytes[8], 4) != 1)
+        return false;
+    size_t count = ReadLE(&bytes[12], 4);
+    size_t pos = 16;
+    for (size_t i = 0; i < count; i++) {
+        if (bytes.size() - pos < RecordHead)
+            return false;
+        const unsigned char* p = &bytes[pos];
+        Record r;
+        r.n = ReadLE(p, 2);
+        r.k = p[2];
+        r.cls = p[3];
+        r.expected = EhResult(EhReason(p[4]), p[5]);
+        if (r.cls >= ClassCount || r.expected.reason >= EhReasonCount)
+            return false;
+        p += 6;
+        r.personalization.assign(reinterpret_cast<const char*>(p),
+                                 strnlen(reinterpret_cast<const char*>(p), EhPersonalizationLength));
+        p += EhPersonalizationLength;
+        r.header = reinterpret_cast<const CBlockHeader*>(p);
+        p += sizeof(CBlockHeader);
+        r.solnLen = ReadLE(p, 2);
+        r.soln = reinterpret_cast<const char*>(p + 2);
+        pos += RecordHead + r.solnLen;
+        if (pos > bytes.size())
+            return false;
+        r.verifier = NULL;
+        records.push_back(r);
+    }
+    return pos == bytes.size();
+}
+
+std::string Describe(const EhResult& result)
+{
+    std::string name = EhReasonName(result.reason);
+    if (result.reason == EhCollision)
+        name += "@" + std::to_string(result.round);
+    return name;
+}
+
+std::string Label(const Record& r)
+{
+    if (r.cls == 3)
+        return Describe(r.expected);
+    return ClassNames[r.cls];
+}
+
+void Report(const std::string& mix, const std::vector<const Record*>& shares, double minNs)
+{
+    if (shares.empty())
+        return;
+    Timing timing = Time([&] {
+        for (const Record* r : shares)
+            benchSink += r->verifier->Check(r->header, r->soln, r->solnLen).reason;
+    }, minNs);
+    double ns = timing.ns / shares.size();
+    printf("  %-18s %6zu %14.0f %12.1f\n", mix.c_str(), shares.size(), 1e9 / ns, ns);
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    const char* path = argc > 1 ? argv[1] : "corpus.bin";
+    double minNs = argc > 2 ? atof(argv[2]) * 1e6 : 200e6;
+
+    std::ifstream in(path, std::ios::binary);
+    std::vector<unsigned char> bytes((std::istreambuf_iterator<char>(in)),
+                                     std::istreambuf_iterator<char>());
+    std::vector<Record> records;
+    if (!in || !ParseCorpus(bytes, records)) {
+        fprintf(stderr, "cannot read %s\n", path);
+        return 1;
+    }
+
+    // One verifier per parameter set and personalization, without a share
+    // cache: replayed shares must be verified every time.
+    std::map<std::string, std::unique_ptr<EhVerifier>> verifiers;
+    std::vector<std::pair<unsigned int, unsigned int>> sets;
+    bool ok = true;
+    for (Record& r : records) {
+        const EhParameters* params = FindEhParameters(r.n, r.k);
+        if (params == NULL) {
+            fprintf(stderr, "%u,%u is not compiled in\n", r.n, r.k);
+            return 1;
+        }
+        std::string id = std::to_string(r.n) + "," + std::to_string(r.k) + " " + r.personalization;
+        std::unique_ptr<EhVerifier>& verifier = verifiers[id];
+        if (!verifier)
+            verifier.reset(new EhVerifier(*params, r.personalization));
+        r.verifier = verifier.get();
+        if (sets.empty() || sets.back() != std::make_pair(r.n, r.k))
+            sets.push_back(std::make_pair(r.n, r.k));
+
+        EhResult result = r.verifier->Check(r.header, r.soln, r.solnLen);
+        if (result.reason != r.expected.reason ||
+                (result.reason == EhCollision && result.round != r.expected.round)) {
+            fprintf(stderr, "%s %s share: got %s, expected %s\n", id.c_str(), Label(r).c_str(),
+                    Describe(result).c_str(), Describe(r.expected).c_str());
+            ok = false;
+        }
+    }
+
+    for (const auto& set : sets) {
+        std::vector<const Record*> valid, invalid;
+        std::vector<std::pair<std::string, std::vector<const Record*>>> classes;
+        for (const Record& r : records) {
+            if (std::make_pair(r.n, r.k) != set)
+                continue;
+            (r.cls == 0 ? valid : invalid).push_back(&r);
+            if (r.cls == 0)
+                continue;
+            std::string label = Label(r);
+            size_t i = 0;
+            while (i < classes.size() && classes[i].first != label)
+                i++;
+            if (i == classes.size())
+                classes.push_back(std::make_pair(label, std::vector<const Record*>()));
+            classes[i].second.push_back(&r);
+        }
+
+        printf("%u,%u\n", set.first, set.second);
+        printf("  %-18s %6s %14s %12s\n", "mix", "shares", "shares/s", "ns/share");
+        Report("valid", valid, minNs);
+        Report("invalid", invalid, minNs);
+        for (const auto& cls : classes)
+            Report("  " + cls.first, cls.second, minNs);
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,214 @@
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Finds Equihash solutions for a header, to seed the share corpus (see
+// mkcorpus.py). It is Wagner's algorithm in its plainest form, hashing with
+// libsodium rather than the verifier's BLAKE2b: slow, memory hungry (about
+// 1.5 GB for 210,9) and not guaranteed to find every solution, but enough
+// to produce valid shares of the parameter sets the verifier carries.
+//
+//   ehsolve n k personalization header-hex [max solutions]
+//
+// prints each solution found as hex, in the minimal encoding with canonical
+// index order, and fails if there is none.
+
+#include <sodium.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+enum : size_t { HeaderBytes=140 };
+
+// The hash bits still to collide, most significant first. N is at most 256.
+struct Row {
+    uint64_t bits[4];
+    uint32_t ref;   // Leaf index in round 0, else a pair of the last round.
+};
+
+uint64_t Top(const Row& row, unsigned int width)
+{
+    return row.bits[0] >> (64 - width);
+}
+
+void ShiftLeft(Row& row, unsigned int shift)
+{
+    for (size_t i = 0; i < 4; i++)
+        row.bits[i] = (row.bits[i] << shift) | (i < 3 ? row.bits[i+1] >> (64 - shift) : 0);
+}
+
+bool ParseHex(const char* hex, unsigned char* out, size_t len)
+{
+    if (strlen(hex) != 2*len)
+        return false;
+    for (size_t i = 0; i < len; i++) {
+        unsigned int byte;
+        if (sscanf(hex + 2*i, "%2x", &byte) != 1)
+            return false;
+        out[i] = byte;
+    }
+    return true;
+}
+
+class Solver
+{
+    unsigned int n, k, collisionBits;
+    // pairs[r][i] are the two rows of round r merged into row i of round r+1.
+    std::vector<std::vector<std::pair<uint32_t, uint32_t>>> pairs;
+
+    // Indices under ref, ordered so that every left subtree starts below its
+    // sibling, as the verifier requires.
+    void Collect(int round, uint32_t ref, std::vector<uint32_t>& out) const
+    {
+        if (round < 0) {
+            out.push_back(ref);
+            return;
+        }
+        std::vector<uint32_t> a, b;
+        Collect(round - 1, pairs[round][ref].first, a);
+        Collect(round - 1, pairs[round][ref].second, b);
+        if (a[0] > b[0])
+            std::swap(a, b);
+        out.insert(out.end(), a.begin(), a.end());
+        out.insert(out.end(), b.begin(), b.end());
+    }
+
+public:
+    Solver(unsigned int n, unsigned int k) : n {n}, k {k}, collisionBits {n/(k+1)} { }
+
+    std::vector<std::vector<uint32_t>> Solve(const char* personalization,
+                                             const unsigned char* header, size_t maxSolutions)
+    {
+        const size_t perHash = 512/n, bytesPerIndex = (n+7)/8, outLen = perHash*bytesPerIndex;
+        unsigned char personal[crypto_generichash_blake2b_PERSONALBYTES] = {0};
+        memcpy(personal, personalization, strlen(personalization));
+        for (size_t i = 0; i < 4; i++) {
+            personal[8+i] = (n >> 8*i) & 0xff;
+            personal[12+i] = (k >> 8*i) & 0xff;
+        }
+        crypto_generichash_blake2b_state base;
+        crypto_generichash_blake2b_init_salt_personal(&base, NULL, 0, outLen, NULL, personal);
+        crypto_generichash_blake2b_update(&base, header, HeaderBytes);
+
+        const uint32_t leaves = uint32_t(1) << (collisionBits + 1);
+        std::vector<Row> rows(leaves);
+        for (uint32_t g = 0; g*perHash < leaves; g++) {
+            crypto_generichash_blake2b_state state = base;
+            unsigned char word[4] = {uint8_t(g), uint8_t(g >> 8), uint8_t(g >> 16), uint8_t(g >> 24)};
+            unsigned char out[64];
+            crypto_generichash_blake2b_update(&state, word, sizeof(word));
+            crypto_generichash_blake2b_final(&state, out, outLen);
+            for (size_t j = 0; j < perHash && g*perHash + j < leaves; j++) {
+                Row& row = rows[g*perHash + j];
+                memset(row.bits, 0, sizeof(row.bits));
+                for (size_t b = 0; b < bytesPerIndex; b++)
+                    row.bits[b/8] |= uint64_t(out[j*bytesPerIndex + b]) << (56 - 8*(b%8));
+                // Keep the first n bits of the slice.
+                if (n % 64)
+                    row.bits[n/64] &= ~(~uint64_t(0) >> (n % 64));
+                row.ref = g*perHash + j;
+            }
+        }
+
+        pairs.clear();
+        for (unsigned int round = 0; round < k; round++) {
+            // The last round collides on the remaining 2*collisionBits bits,
+            // which leaves an all-zero XOR.
+            const unsigned int width = round == k-1 ? 2*collisionBits : collisionBits;
+            std::sort(rows.begin(), rows.end(), [width](const Row& a, const Row& b) {
+                return Top(a, width) < Top(b, width);
+            });
+            std::vector<Row> next;
+            next.reserve(rows.size() + rows.size()/8);
+            pairs.emplace_back();
+            std::vector<std::pair<uint32_t, uint32_t>>& merged = pairs.back();
+            // Large buckets are paired with their next few rows only, and a
+            // round stops growing past 9/8 of its input, which bounds memory
+            // at the price of a few solutions.
+            for (size_t i = 0; i < rows.size() && next.size() < rows.size() + rows.size()/8; ) {
+                size_t end = i + 1;
+                while (end < rows.size() && Top(rows[end], width) == Top(rows[i], width))
+                    end++;
+                for (size_t a = i; a < end; a++) {
+                    for (size_t b = a + 1; b < end && b < a + 8; b++) {
+                        Row row;
+                        for (size_t w = 0; w < 4; w++)
+                            row.bits[w] = rows[a].bits[w] ^ rows[b].bits[w];
+                        ShiftLeft(row, collisionBits);
+                        row.ref = merged.size();
+                        merged.push_back(std::make_pair(rows[a].ref, rows[b].ref));
+                        next.push_back(row);
+                    }
+                }
+                i = end;
+            }
+            rows.swap(next);
+            fprintf(stderr, "round %u: %zu rows\n", round, rows.size());
+        }
+
+        std::vector<std::vector<uint32_t>> solutions;
+        for (size_t i = 0; i < rows.size() && solutions.size() < maxSolutions; i++) {
+            std::vector<uint32_t> indices;
+            Collect(k - 1, rows[i].ref, indices);
+            std::vector<uint32_t> sorted = indices;
+            std::sort(sorted.begin(), sorted.end());
+            if (std::adjacent_find(sorted.begin(), sorted.end()) != sorted.end())
+                continue;
+            if (std::find(solutions.begin(), solutions.end(), indices) == solutions.end())
+                solutions.push_back(indices);
+        }
+        return solutions;
+    }
+
+    // The minimal encoding: indices of collisionBits+1 bits, big-endian.
+    std::string Encode(const std::vector<uint32_t>& indices) const
+    {
+        std::string hex;
+        uint64_t acc = 0;
+        unsigned int accBits = 0;
+        for (uint32_t index : indices) {
+            acc = (acc << (collisionBits + 1)) | index;
+            accBits += collisionBits + 1;
+            while (accBits >= 8) {
+                char byte[3];
+                snprintf(byte, sizeof(byte), "%02x", unsigned((acc >> (accBits - 8)) & 0xff));
+                hex += byte;
+                accBits -= 8;
+            }
+        }
+        return hex;
+    }
+};
+
+}
+
+int main(int argc, char** argv)
+{
+    unsigned char header[HeaderBytes];
+    if (argc < 5 || argc > 6) {
+        fprintf(stderr, "usage: %s n k personalization header-hex [max solutions]\n", argv[0]);
+        return 2;
+    }
+    unsigned int n = atoi(argv[1]), k = atoi(argv[2]);
+    size_t maxSolutions = argc > 5 ? strtoul(argv[5], NULL, 10) : 1;
+    if (k < 1 || n > 256 || n % (k+1) != 0 || n/(k+1) + 1 > 26 ||
+            strlen(argv[3]) == 0 || strlen(argv[3]) > 8 || !ParseHex(argv[4], header, HeaderBytes)) {
+        fprintf(stderr, "%s: bad parameters, personalization or header\n", argv[0]);
+        return 2;
+    }
+    if (sodium_init() < 0)
+        return 2;
+
+    Solver solver(n, k);
+    std::vector<std::vector<uint32_t>> solutions = solver.Solve(argv[3], header, maxSolutions);
+    for (size_t i = 0; i < solutions.size(); i++)
+        printf("%s\n", solver.Encode(solutions[i]).c_str());
+    return solutions.empty() ? 1 : 0;
+}
@@ -0,0 +1,216 @@
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Times each stage of a share check for every parameter set compiled in,
+// on the valid shares of a vector file:
+//
+//   equibench [vectors [milliseconds per stage]]
+//
+// Cycles are left out where there is no time stamp counter.
+
+#include "bench.h"
+#include "equi.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+volatile uint64_t benchSink;
+
+namespace {
+
+struct Vector {
+    unsigned int n, k;
+    std::string personalization;
+    std::vector<unsigned char> header;
+    std::vector<unsigned char> soln;
+};
+
+double minNs = 200e6;
+
+bool ParseHex(const std::string& hex, std::vector<unsigned char>& out)
+{
+    if (hex.size() % 2 != 0)
+        return false;
+    out.resize(hex.size() / 2);
+    for (size_t i = 0; i < out.size(); i++) {
+        char* end;
+        std::string byte = hex.substr(2*i, 2);
+        out[i] = strtoul(byte.c_str(), &end, 16);
+        if (*end != '\0')
+            return false;
+    }
+    return true;
+}
+
+bool ReadVectors(const char* path, std::vector<Vector>& vectors)
+{
+    std::ifstream in(path);
+    if (!in)
+        return false;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#')
+            continue;
+        std::istringstream fields(line);
+        Vector v;
+        std::string header, soln;
+        if (!(fields >> v.n >> v.k >> v.personalization >> header >> soln) ||
+                !ParseHex(header, v.header) || !ParseHex(soln, v.soln) ||
+                v.header.size() != sizeof(CBlockHeader)) {
+            fprintf(stderr, "%s: bad line: %.40s...\n", path, line.c_str());
+            return false;
+        }
+        vectors.push_back(v);
+    }
+    return true;
+}
+
+void Report(const char* stage, const Timing& timing)
+{
+#ifdef EH_HAVE_TSC
+    printf("  %-16s %12.1f %12.0f\n", stage, timing.ns, timing.cycles);
+#else
+    printf("  %-16s %12.1f %12s\n", stage, timing.ns, "-");
+#endif
+}
+
+template<unsigned int N, unsigned int K>
+bool BenchSet(const Vector& v)
+{
+    typedef Equihash<N,K> Eh;
+    if (v.soln.size() != Eh::SolutionWidth) {
+        fprintf(stderr, "%u,%u: solution should be %zu bytes\n", N, K, size_t(Eh::SolutionWidth));
+        return false;
+    }
+
+    const char* personalization = v.personalization.c_str();
+    const CBlockHeader* header = reinterpret_cast<const CBlockHeader*>(v.header.data());
+    const unsigned char* soln = v.soln.data();
+
+    eh_HashState base_state;
+    if (Eh::InitialiseState(base_state, personalization) != 0) {
+        fprintf(stderr, "%u,%u: bad personalization %s\n", N, K, personalization);
+        return false;
+    }
+    eh_HashState state = base_state;
+    AbsorbHeader(state, header);
+    if (Eh::IsValidSolution(state, soln, NULL).reason != EhValid) {
+        fprintf(stderr, "%u,%u %s: the share is not valid\n", N, K, personalization);
+        return false;
+    }
+
+    // Too large for the stack of some platforms at 200,9 and up.
+    std::unique_ptr<typename Eh::Work> work(new typename Eh::Work);
+    std::unique_ptr<typename Eh::Work> leaves(new typename Eh::Work);
+    Eh::UnpackSolution(soln, *work);
+    Eh::CheckIndices(*work);
+
+    printf("%u,%u %s, %zu of %u leaf hashes computed\n", N, K, personalization,
+           work->blockCount, 1u << K);
+    printf("  %-16s %12s %12s\n", "stage", "ns/op", "cycles/op");
+
+    Report("init", Time([&] {
+        eh_HashState s;
+        Eh::InitialiseState(s, personalization);
+        benchSink += reinterpret_cast<const unsigned char*>(&s)[0];
+    }, minNs));
+    Report("header absorb", Time([&] {
+        eh_HashState s = base_state;
+        AbsorbHeader(s, header);
+        benchSink += reinterpret_cast<const unsigned char*>(&s)[0];
+    }, minNs));
+    Report("index unpack", Time([&] {
+        Eh::UnpackSolution(soln, *work);
+        benchSink += work->indices[0];
+    }, minNs));
+    Report("index checks", Time([&] {
+        benchSink += Eh::CheckIndices(*work);
+    }, minNs));
+    Report("leaf hashing", Time([&] {
+        Eh::HashLeaves(state, *work);
+        benchSink += work->blockHashes[0];
+    }, minNs));
+
+    // Collapsing overwrites the rows, so every run starts from a copy of
+    // the leaves; the time of the copy alone is taken off.
+    memcpy(leaves->rows, work->rows, sizeof(work->rows));
+    Timing restore = Time([&] {
+        memcpy(work->rows, leaves->rows, sizeof(work->rows));
+        benchSink += reinterpret_cast<const unsigned char*>(work->rows)[0];
+    }, minNs);
+    Timing collapse = Time([&] {
+        memcpy(work->rows, leaves->rows, sizeof(work->rows));
+        benchSink += Eh::CollapseTree(*work).reason;
+    }, minNs);
+    collapse.ns = std::max(collapse.ns - restore.ns, 0.0);
+    collapse.cycles = std::max(collapse.cycles - restore.cycles, 0.0);
+    Report("collapse", collapse);
+
+    // A verification as the verifier runs one: the personalized state is
+    // set up once, each share absorbs its header into a copy.
+    Report("verify", Time([&] {
+        eh_HashState s = base_state;
+        AbsorbHeader(s, header);
+        benchSink += Eh::IsValidSolution(s, soln, NULL).reason;
+    }, minNs));
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    const char* path = argc > 1 ? argv[1] : "vectors.txt";
+    if (argc > 2)
+        minNs = atof(argv[2]) * 1e6;
+
+    std::vector<Vector> vectors;
+    if (!ReadVectors(path, vectors)) {
+        fprintf(stderr, "cannot read %s\n", path);
+        return 1;
+    }
+
+    // The leaf hash backend, chosen by the same self-benchmark as in the
+    // addon, and what it measured for each candidate.
+    const Blake2bBackendSelection& selection = Blake2bSelection();
+    printf("leaf hash backend %s%s\n", selection.backends[selection.selected].name,
+           selection.forced ? " (forced)" : "");
+    for (size_t i = 0; i < selection.count; i++) {
+        const Blake2bBackend& backend = selection.backends[i];
+        if (backend.correct)
+            printf("  %-16s %12.1f ns/hash\n", backend.name, backend.nsPerHash);
+        else
+            printf("  %-16s %12s\n", backend.name, backend.supported ? "failed self-test" : "unsupported");
+    }
+
+    bool ok = true;
+    for (const Vector& v : vectors) {
+#define EH_BENCH(bn, bk) \
+        if (v.n == bn && v.k == bk) { \
+            ok = BenchSet<bn, bk>(v) && ok; \
+            continue; \
+        }
+        EH_PARAMETER_SETS(EH_BENCH)
+#undef EH_BENCH
+        fprintf(stderr, "%u,%u is not compiled in\n", v.n, v.k);
+        ok = false;
+    }
+
+    size_t count;
+    const EhParameters* sets = EhParameterSets(count);
+    for (size_t i = 0; i < count; i++) {
+        bool covered = false;
+        for (const Vector& v : vectors)
+            covered = covered || (v.n == sets[i].n && v.k == sets[i].k);
+        if (!covered)
+            fprintf(stderr, "%u,%u has no vector in %s\n", sets[i].n, sets[i].k, path);
+    }
+    return ok ? 0 : 1;
+}
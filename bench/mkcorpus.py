@@ -0,0 +1,243 @@
+#!/usr/bin/env python3
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+"""Builds the share corpus replayed by corpusbench, corpus.js and capitest.
+
+    mkcorpus.py [seeds [corpus]]
+    mkcorpus.py find n k personalization [header-hex]
+
+The first form reads seeds (default corpus.txt next to this script), one
+header per line with the valid solutions known for it, and writes corpus
+(default corpus.bin) in the format described in corpusbench.cpp. From each
+seed line it derives shares of every failure class: subtrees swapped out
+of order, duplicated indices, a collision failing at each round, the wrong
+personalization and the wrong length. Every verdict in the corpus comes
+from reference() below, a bit-by-bit reading of the Equihash paper that
+shares no code with the C++ verifier, and a derived share whose verdict is
+not the one it was built for is an error.
+
+A collision failing at round r is made by grafting a subtree of width 2^r
+from another solution of the same header, or, with a single solution, by
+exchanging two subtrees of width 2^r that are not siblings. The last round
+can only come from a second solution.
+
+The second form finds a seed line for a new parameter set or
+personalization: it runs ehsolve (make -C bench ehsolve) on header, by
+default the 96,5 header of test.js, with its first nonce byte set to 1, 2,
+... until one has at least two solutions, and prints the line to append to
+corpus.txt.
+"""
+
+import hashlib
+import os
+import struct
+import subprocess
+import sys
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+# EhReason and the corpus classes, by value.
+VALID, BAD_LENGTH, ABOVE_TARGET, INDEX_ORDER, DUPLICATE_INDEX, COLLISION, NONZERO_FINAL = range(7)
+CLASSES = ['valid', 'indexOrder', 'duplicateIndex', 'collision', 'personalization', 'badLength']
+
+TEST_HEADER = (
+    '000000206B0A233CC0AEA1DC012D9C1093CD9A3421F35034F7A832A4F4747CB12A000000512E047C94'
+    '6E6BB580FD678ACBA888107679347785DC16974CEA68B36228D1C1000000000000000000000000000000'
+    '0000000000000000000000000000000000E73DB25937EB6B1D30000AEF4C270000000000000000000000'
+    '000001000000000000000000000000')
+
+
+def unpack(solution, bits):
+    value = int.from_bytes(solution, 'big')
+    count = len(solution) * 8 // bits
+    return [(value >> (bits * (count - 1 - i))) & ((1 << bits) - 1) for i in range(count)]
+
+
+def pack(indices, bits):
+    value = 0
+    for index in indices:
+        value = (value << bits) | index
+    return value.to_bytes(len(indices) * bits // 8, 'big')
+
+
+def reference(n, k, personalization, header, solution):
+    """Returns the (reason, round) the verifier must give a share."""
+    collision_bits = n // (k + 1)
+    if len(solution) != (1 << k) * (collision_bits + 1) // 8:
+        return BAD_LENGTH, 0
+    indices = unpack(solution, collision_bits + 1)
+
+    # The verifier checks every subtree's order, then duplicates, then hashes.
+    width = 1
+    while width < len(indices):
+        for i in range(0, len(indices), 2 * width):
+            if indices[i + width] < indices[i]:
+                return INDEX_ORDER, 0
+        width *= 2
+    if len(set(indices)) != len(indices):
+        return DUPLICATE_INDEX, 0
+
+    # Leaf i is the first n bits of slice i % per_hash of the BLAKE2b output
+    # for i // per_hash, each slice (n + 7) // 8 bytes long.
+    per_hash = 512 // n
+    slice_bytes = (n + 7) // 8
+    person = personalization + struct.pack('<II', n, k)
+
+    def leaf(index):
+        digest = hashlib.blake2b(header + struct.pack('<I', index // per_hash),
+                                 digest_size=per_hash * slice_bytes, person=person).digest()
+        start = (index % per_hash) * slice_bytes
+        return int.from_bytes(digest[start:start + slice_bytes], 'big') >> (slice_bytes * 8 - n)
+
+    rows = [leaf(index) for index in indices]
+    for rnd in range(k):
+        merged = []
+        for a, b in zip(rows[0::2], rows[1::2]):
+            if (a ^ b) >> (n - collision_bits * (rnd + 1)):
+                return COLLISION, rnd
+            merged.append(a ^ b)
+        rows = merged
+    return (VALID, 0) if rows[0] == 0 else (NONZERO_FINAL, 0)
+
+
+def canonical(indices):
+    """Reorders siblings so that every left subtree starts below its sibling.
+    XOR does not depend on the order, so the collisions are unchanged."""
+    indices = list(indices)
+    width = 1
+    while width < len(indices):
+        for i in range(0, len(indices), 2 * width):
+            if indices[i] > indices[i + width]:
+                indices[i:i + 2 * width] = indices[i + width:i + 2 * width] + indices[i:i + width]
+        width *= 2
+    return indices
+
+
+class Family:
+    """The shares derived from one seed line."""
+
+    def __init__(self, n, k, personalization, header, solutions):
+        self.n, self.k = n, k
+        self.personalization = personalization
+        self.header = header
+        self.solutions = solutions
+        self.bits = n // (k + 1) + 1
+        self.records = []
+
+    def add(self, cls, solution, want, personalization=None):
+        personalization = personalization or self.personalization
+        verdict = reference(self.n, self.k, personalization, self.header, solution)
+        if want is not None and verdict != want:
+            return False
+        self.records.append((cls, verdict, personalization, solution))
+        return True
+
+    def collision(self, rnd):
+        a = unpack(self.solutions[0], self.bits)
+        width = 1 << rnd
+        for other in self.solutions[1:]:
+            b = unpack(other, self.bits)
+            for j in range(len(a) // width):
+                grafted = a[:j * width] + b[j * width:(j + 1) * width] + a[(j + 1) * width:]
+                if self.add('collision', pack(grafted, self.bits), (COLLISION, rnd)):
+                    return True
+        # Subtree 0 against a subtree of another parent: both still collide
+        # inside, but their new siblings do not.
+        for j in range(2, len(a) // width):
+            swapped = list(a)
+            swapped[0:width], swapped[j * width:(j + 1) * width] = \
+                a[j * width:(j + 1) * width], a[0:width]
+            if self.add('collision', pack(canonical(swapped), self.bits), (COLLISION, rnd)):
+                return True
+        return False
+
+    def derive(self):
+        for solution in self.solutions:
+            if not self.add('valid', solution, (VALID, 0)):
+                raise ValueError('%d,%d seed solution %s... is not valid'
+                                 % (self.n, self.k, solution.hex()[:16]))
+        a = unpack(self.solutions[0], self.bits)
+        for rnd in range(self.k):
+            width = 1 << rnd
+            swapped = a[width:2 * width] + a[0:width] + a[2 * width:]
+            assert self.add('indexOrder', pack(swapped, self.bits), (INDEX_ORDER, 0))
+        # The first leaf pair, then the last, made of one index twice.
+        assert self.add('duplicateIndex', pack(a[:1] + a[:1] + a[2:], self.bits),
+                        (DUPLICATE_INDEX, 0))
+        assert self.add('duplicateIndex', pack(a[:-1] + a[-2:-1], self.bits),
+                        (DUPLICATE_INDEX, 0))
+        for rnd in range(self.k):
+            if not self.collision(rnd):
+                print('%d,%d %s: no collision at round %d, add a second solution'
+                      % (self.n, self.k, self.personalization.decode(), rnd), file=sys.stderr)
+        other = b'BgoldPoW' if self.personalization == b'ZcashPoW' else b'ZcashPoW'
+        self.add('personalization', self.solutions[0], None, other)
+        assert self.add('badLength', self.solutions[0][:-1], (BAD_LENGTH, 0))
+        return self
+
+
+def read_seeds(path):
+    families = []
+    with open(path) as seeds:
+        for number, line in enumerate(seeds, 1):
+            fields = line.split('#', 1)[0].split()
+            if not fields:
+                continue
+            if len(fields) < 5:
+                raise ValueError('%s:%d: expected n k personalization header solution...'
+                                 % (path, number))
+            header = bytes.fromhex(fields[3])
+            if len(header) != 140:
+                raise ValueError('%s:%d: header is not 140 bytes' % (path, number))
+            families.append(Family(int(fields[0]), int(fields[1]), fields[2].encode(), header,
+                                   [bytes.fromhex(s) for s in fields[4:]]))
+    return families
+
+
+def write_corpus(path, families):
+    records = [(f, r) for f in families for r in f.records]
+    with open(path, 'wb') as out:
+        out.write(b'EHCORPUS' + struct.pack('<II', 1, len(records)))
+        for family, (cls, (reason, rnd), personalization, solution) in records:
+            out.write(struct.pack('<HBBBB', family.n, family.k, CLASSES.index(cls), reason, rnd))
+            out.write(personalization.ljust(8, b'\0') + family.header)
+            out.write(struct.pack('<H', len(solution)) + solution)
+    return len(records)
+
+
+def find(n, k, personalization, header):
+    solver = os.path.join(HERE, 'ehsolve')
+    header = bytearray(header)
+    for nonce in range(1, 256):
+        header[108] = nonce
+        run = subprocess.run([solver, str(n), str(k), personalization, header.hex(), '8'],
+                             stdout=subprocess.PIPE, stderr=subprocess.DEVNULL,
+                             universal_newlines=True)
+        solutions = run.stdout.split()
+        print('nonce byte %d: %d solutions' % (nonce, len(solutions)), file=sys.stderr)
+        if len(solutions) >= 2:
+            return '%d %d %s %s %s' % (n, k, personalization, header.hex(), ' '.join(solutions))
+    return None
+
+
+def main(argv):
+    if argv[1:2] == ['find']:
+        if len(argv) not in (5, 6):
+            print(__doc__, file=sys.stderr)
+            return 2
+        line = find(int(argv[2]), int(argv[3]), argv[4],
+                    bytes.fromhex(argv[5] if len(argv) > 5 else TEST_HEADER))
+        if line is None:
+            return 1
+        print(line)
+        return 0
+    seeds = argv[1] if len(argv) > 1 else os.path.join(HERE, 'corpus.txt')
+    corpus = argv[2] if len(argv) > 2 else os.path.join(HERE, 'corpus.bin')
+    families = [family.derive() for family in read_seeds(seeds)]
+    print('%s: %d records' % (corpus, write_corpus(corpus, families)), file=sys.stderr)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -9,9 +9,9 @@
                 "equihashverify.cc",
             ],
             "include_dirs": [
-                "<!(node -e \"require('nan')\")"
             ],
             "defines": [
+                "NAPI_VERSION=6",
             ],
             "cflags_cc": [
                 "-std=c++11",
@@ -30,7 +30,13 @@
             "dependencies": [
             ],
             "sources": [
-                "src/equi/equi.cpp"
+                "src/equi/blake2b.cpp",
+                "src/equi/blake2b_lanes.cpp",
+                "src/equi/equi.cpp",
+                "src/equi/sharecache.cpp",
+                "src/equi/sharering.cpp",
+                "src/equi/verifier.cpp",
+                "src/equi/workerpool.cpp"
             ],
             "include_dirs": [
             ],
@@ -44,7 +50,8 @@
             ],
             "link_settings": {
                 "libraries": [
-                    "-lsodium"
+                    "-lsodium",
+                    "-pthread"
                 ],
             },
         }
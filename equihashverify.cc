@@ -1,44 +1,1147 @@
-#include <nan.h>
-#include <node.h>
-#include <node_buffer.h>
-#include <v8.h>
+#include <node_api.h>
 #include <stdint.h>
 
+#include <cmath>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
 #include "src/equi/equi.h"
+#include "src/equi/sharering.h"
+#include "src/equi/verifier.h"
+#include "src/equi/workerpool.h"
+
+
+// The addon only uses N-API, so one build loads in every Node release that
+// provides NAPI_VERSION, and it is context aware: the main thread and each
+// worker_threads Worker get their own instance of the state below.
+
+// Hands finished jobs from the worker pool back to one environment. Jobs
+// keep it alive, so a worker finishing after its environment was torn down
+// finds closed set instead of a dangling thread-safe function. Jobs read the
+// caller's buffers in place, so teardown also waits for the running ones.
+struct Completion {
+  std::mutex lock;
+  std::condition_variable idle;
+  napi_threadsafe_function tsfn;
+  size_t running;
+  bool closed;
+
+  Completion() : tsfn {NULL}, running {0}, closed {false} { }
+};
+
+// Per-environment state, stored as the instance data of the addon.
+struct AddonData {
+  // Used by the module level functions, which predate createVerifier().
+  std::shared_ptr<EhVerifier> defaultVerifier;
+  std::shared_ptr<Completion> completion;
+  // Asynchronous verifies not yet called back. The thread-safe function
+  // only keeps the event loop alive while this is non-zero.
+  size_t pending;
+
+  AddonData() : pending {0} { }
+};
+
+// A share queued for verification on the worker pool. The header (or the
+// nonce, for shares of a prepared job) and solution are read in place: the
+// job holds references to the caller's buffers until its callback has run.
+struct AsyncVerifyJob {
+  AddonData *addon;
+  std::shared_ptr<Completion> completion;
+  std::shared_ptr<const EhVerifier> verifier;
+  const CBlockHeader *header;
+  EhMidstate midstate;
+  const unsigned char *nonce;
+  const char *solution;
+  size_t solutionLength;
+  EhResult result;
+  napi_ref callback;
+  napi_ref buffers[2];
+  napi_async_context context;
+};
+
+// The native side of a Verifier instance.
+struct VerifierWrap {
+  std::shared_ptr<EhVerifier> verifier;
+};
+
+// A share ring attached to a SharedArrayBuffer by one environment. Any
+// environment holding the buffer may submit shares and kick the ring, so
+// live rings are kept in a process-wide table by id.
+struct ShareRingEntry {
+  uint32_t id;
+  std::shared_ptr<EhShareRing> ring;
+  napi_env env;
+  napi_ref memory;
+  napi_threadsafe_function signal;
+};
+
+static std::mutex ringsLock;
+static std::map<uint32_t, std::shared_ptr<ShareRingEntry>> rings;
+static uint32_t lastRingId = 0;
+
+// Passed as callback data to Verifier prototype methods, which act on the
+// wrapped instance rather than on the default verifier.
+static char verifierMethod;
+
+// Exported functions stay writable so that index.js can wrap them.
+static const napi_property_attributes methodAttributes =
+  static_cast<napi_property_attributes>(napi_writable | napi_configurable);
+
+// The pool is shared by every environment, created on the first
+// asynchronous verify and deliberately never destroyed: its threads stay
+// parked until the process exits.
+static std::mutex poolLock;
+static WorkerPool *pool = NULL;
+static size_t poolThreads = 0;
+
+
+static WorkerPool* GetPool() {
+  std::lock_guard<std::mutex> guard(poolLock);
+  if (pool == NULL)
+    pool = new WorkerPool(poolThreads > 0 ? poolThreads : WorkerPool::DefaultSize());
+  return pool;
+}
+
+
+static napi_value NewUint32(napi_env env, uint32_t value) {
+  napi_value result;
+  napi_create_uint32(env, value, &result);
+  return result;
+}
+
+
+static napi_value NewNumber(napi_env env, double value) {
+  napi_value result;
+  napi_create_double(env, value, &result);
+  return result;
+}
+
+
+static napi_value NewString(napi_env env, const char *value) {
+  napi_value result;
+  napi_create_string_utf8(env, value, NAPI_AUTO_LENGTH, &result);
+  return result;
+}
+
+
+static napi_value NewBoolean(napi_env env, bool value) {
+  napi_value result;
+  napi_get_boolean(env, value, &result);
+  return result;
+}
+
+
+// Reads value as a uint32_t, failing for anything that is not an integral
+// number in range.
+static bool GetUint32(napi_env env, napi_value value, uint32_t *out) {
+  napi_valuetype type;
+  double number;
+  if (napi_typeof(env, value, &type) != napi_ok || type != napi_number ||
+      napi_get_value_double(env, value, &number) != napi_ok)
+    return false;
+  if (number < 0 || number > UINT32_MAX || std::floor(number) != number)
+    return false;
+  *out = static_cast<uint32_t>(number);
+  return true;
+}
+
+
+static bool GetString(napi_env env, napi_value value, std::string& out) {
+  size_t length;
+  if (napi_get_value_string_utf8(env, value, NULL, 0, &length) != napi_ok)
+    return false;
+  std::vector<char> buffer(length + 1);
+  napi_get_value_string_utf8(env, value, buffer.data(), buffer.size(), &length);
+  out.assign(buffer.data(), length);
+  return true;
+}
+
+
+static bool IsBuffer(napi_env env, napi_value value) {
+  bool result = false;
+  napi_is_buffer(env, value, &result);
+  return result;
+}
+
+
+static bool IsFunction(napi_env env, napi_value value) {
+  napi_valuetype type;
+  return napi_typeof(env, value, &type) == napi_ok && type == napi_function;
+}
+
+
+// N-API has no napi_is_sharedarraybuffer, so this asks the global
+// constructor. Fails when SharedArrayBuffer is not exposed.
+static bool IsSharedArrayBuffer(napi_env env, napi_value value) {
+  napi_value global, constructor;
+  bool result = false;
+  napi_get_global(env, &global);
+  if (napi_get_named_property(env, global, "SharedArrayBuffer", &constructor) == napi_ok &&
+      IsFunction(env, constructor))
+    napi_instanceof(env, value, constructor, &result);
+  return result;
+}
+
+
+static const char* BufferData(napi_env env, napi_value buffer, size_t *length = NULL) {
+  void *data;
+  size_t len;
+  napi_get_buffer_info(env, buffer, &data, &len);
+  if (length != NULL)
+    *length = len;
+  return static_cast<const char*>(data);
+}
+
+
+// Fetches the arguments of a call and the verifier it applies to: the
+// wrapped instance for Verifier methods, the default verifier for module
+// functions. argc is the capacity of argv on entry and the number of
+// arguments passed on return. Throws and returns NULL on a bad receiver.
+static std::shared_ptr<EhVerifier> GetCall(napi_env env, napi_callback_info info,
+                                           size_t& argc, napi_value *argv) {
+  napi_value self;
+  void *data;
+  napi_get_cb_info(env, info, &argc, argv, &self, &data);
+
+  if (data != &verifierMethod) {
+    AddonData *addon;
+    napi_get_instance_data(env, reinterpret_cast<void**>(&addon));
+    return addon->defaultVerifier;
+  }
+
+  VerifierWrap *wrap;
+  if (napi_unwrap(env, self, reinterpret_cast<void**>(&wrap)) != napi_ok) {
+  napi_throw_type_error(env, NULL, "Illegal invocation.");
+  return std::shared_ptr<EhVerifier>();
+  }
+  return wrap->verifier;
+}
+
+
+static void CallVerifyCallback(napi_env env, napi_value, void *context, void *data) {
+  AsyncVerifyJob *job = static_cast<AsyncVerifyJob*>(data);
+
+  // env is NULL when the environment is going away with jobs still queued;
+  // their references go away with it.
+  if (env != NULL) {
+    AddonData *addon = static_cast<AddonData*>(context);
+    napi_handle_scope scope;
+    napi_open_handle_scope(env, &scope);
+
+    napi_value global, callback, argv[4], exception = NULL;
+    napi_get_global(env, &global);
+    napi_get_reference_value(env, job->callback, &callback);
+    napi_get_null(env, &argv[0]);
+    argv[1] = NewBoolean(env, job->result.Valid());
+    argv[2] = NewString(env, EhReasonName(job->result.reason));
+    argv[3] = NewBoolean(env, job->result.duplicate);
+    if (napi_make_callback(env, job->context, global, callback, 4, argv, NULL) ==
+        napi_pending_exception)
+      napi_get_and_clear_last_exception(env, &exception);
+
+    napi_delete_reference(env, job->callback);
+    napi_delete_reference(env, job->buffers[0]);
+    napi_delete_reference(env, job->buffers[1]);
+    napi_async_destroy(env, job->context);
+    if (--addon->pending == 0)
+      napi_unref_threadsafe_function(env, addon->completion->tsfn);
+
+    // A throwing callback is reported like any other uncaught exception.
+    if (exception != NULL)
+      napi_fatal_exception(env, exception);
+    napi_close_handle_scope(env, scope);
+  }
+
+  delete job;
+}
+
+
+static EhResult CheckJob(const AsyncVerifyJob *job) {
+  if (job->midstate)
+    return job->verifier->CheckNonce(job->midstate, job->nonce, job->solution, job->solutionLength);
+  return job->verifier->Check(job->header, job->solution, job->solutionLength);
+}
+
+
+static void RunVerifyJob(AsyncVerifyJob *job) {
+  std::shared_ptr<Completion> completion = job->completion;
+  {
+    // Once closed, the buffers the job points into may already be gone.
+    std::lock_guard<std::mutex> guard(completion->lock);
+    if (completion->closed) {
+      delete job;
+      return;
+    }
+    completion->running++;
+  }
+
+  job->result = CheckJob(job);
+
+  std::lock_guard<std::mutex> guard(completion->lock);
+  completion->running--;
+  if (completion->closed) {
+    completion->idle.notify_all();
+    delete job;
+  } else if (napi_call_threadsafe_function(completion->tsfn, job, napi_tsfn_nonblocking) != napi_ok) {
+    delete job;
+  }
+}
+
+
+static AsyncVerifyJob* NewVerifyJob(napi_env env, const std::shared_ptr<const EhVerifier>& verifier,
+                                    napi_value callback) {
+  AddonData *addon;
+  napi_get_instance_data(env, reinterpret_cast<void**>(&addon));
+
+  AsyncVerifyJob *job = new AsyncVerifyJob();
+  job->addon = addon;
+  job->completion = addon->completion;
+  job->verifier = verifier;
+  napi_create_reference(env, callback, 1, &job->callback);
+  napi_async_init(env, NULL, NewString(env, "equihashverify:verify"), &job->context);
+  return job;
+}
+
+
+// share is the header buffer, or the nonce buffer for shares of a prepared
+// job. Both it and solution must stay unmodified until the callback runs.
+static void SubmitVerifyJob(napi_env env, AsyncVerifyJob *job, napi_value share, napi_value solution) {
+  napi_create_reference(env, share, 1, &job->buffers[0]);
+  napi_create_reference(env, solution, 1, &job->buffers[1]);
+  job->solution = BufferData(env, solution, &job->solutionLength);
+
+  if (job->addon->pending++ == 0)
+    napi_ref_threadsafe_function(env, job->addon->completion->tsfn);
+
+  // A solution of the wrong size is rejected without a trip to the pool.
+  if (job->solutionLength != job->verifier->Parameters().solutionSize) {
+    job->result = CheckJob(job);
+    napi_call_threadsafe_function(job->completion->tsfn, job, napi_tsfn_nonblocking);
+    return;
+  }
+  GetPool()->Submit([job] { RunVerifyJob(job); });
+}
+
+
+static bool GetJobId(napi_env env, napi_value value, std::string& jobId) {
+  napi_valuetype type;
+  napi_typeof(env, value, &type);
+  if (type != napi_string && type != napi_number) {
+  napi_throw_type_error(env, NULL, "Job id should be a string or a number.");
+  return false;
+  }
+  napi_value id;
+  napi_coerce_to_string(env, value, &id);
+  return GetString(env, id, jobId);
+}
+
+
+// Looks up a prepared job for verifyJob/verifyJobAsync, checking the nonce
+// and solution arguments on the way. Throws and returns an empty midstate on
+// any error.
+static EhMidstate GetJobShare(napi_env env, napi_value *argv, const EhVerifier& verifier) {
+  std::string jobId;
+  if (!GetJobId(env, argv[0], jobId))
+    return EhMidstate();
+
+  if(!IsBuffer(env, argv[1]) || !IsBuffer(env, argv[2])) {
+  napi_throw_type_error(env, NULL, "Arguments should be buffer objects.");
+  return EhMidstate();
+  }
+
+  size_t nonceLength;
+  BufferData(env, argv[1], &nonceLength);
+  if (nonceLength != sizeof(uint256)) {
+  napi_throw_range_error(env, NULL, "Nonce should be 32 bytes long.");
+  return EhMidstate();
+  }
+
+  EhMidstate midstate = verifier.FindJob(jobId);
+  if (!midstate) {
+  napi_throw_error(env, NULL, "Unknown job id.");
+  }
+  return midstate;
+}
+
+
+// Checks the header and solution arguments of verify, check and verifyAsync.
+// The header must be exactly one CBlockHeader so the core can read it in
+// place; a solution of the wrong size is left to the verifier, which
+// rejects it as badLength before hashing anything. Throws on any error.
+static bool GetShare(napi_env env, napi_value *argv, const CBlockHeader **header,
+                     const char **soln, size_t *solnLength) {
+  if(!IsBuffer(env, argv[0]) || !IsBuffer(env, argv[1])) {
+  napi_throw_type_error(env, NULL, "Arguments should be buffer objects.");
+  return false;
+  }
+
+  size_t hdrLength;
+  const char *hdr = BufferData(env, argv[0], &hdrLength);
+  if (hdrLength != sizeof(CBlockHeader)) {
+  napi_throw_range_error(env, NULL, "Header should be 140 bytes long.");
+  return false;
+  }
+
+  *header = reinterpret_cast<const CBlockHeader*>(hdr);
+  *soln = BufferData(env, argv[1], solnLength);
+  return true;
+}
+
+
+static napi_value Verify(napi_env env, napi_callback_info info) {
+  size_t argc = 2;
+  napi_value argv[2];
+  std::shared_ptr<EhVerifier> verifier = GetCall(env, info, argc, argv);
+  if (!verifier)
+    return NULL;
+
+  if (argc < 2) {
+  napi_throw_type_error(env, NULL, "Wrong number of arguments");
+  return NULL;
+  }
+
+  const CBlockHeader *header;
+  const char *soln;
+  size_t solnLength;
+  if (!GetShare(env, argv, &header, &soln, &solnLength))
+    return NULL;
+
+  EhResult result = verifier->Check(header, soln, solnLength);
+  return NewBoolean(env, result.Valid());
+}
+
+
+// { valid, reason[, round], duplicate } for a verdict. round is only set for
+// collision failures; duplicate is set when the verdict comes from the share
+// cache.
+static napi_value NewResult(napi_env env, const EhResult& result) {
+  napi_value ret;
+  napi_create_object(env, &ret);
+  napi_set_named_property(env, ret, "valid", NewBoolean(env, result.Valid()));
+  napi_set_named_property(env, ret, "reason", NewString(env, EhReasonName(result.reason)));
+  if (result.reason == EhCollision)
+    napi_set_named_property(env, ret, "round", NewUint32(env, result.round));
+  napi_set_named_property(env, ret, "duplicate", NewBoolean(env, result.duplicate));
+  return ret;
+}
+
+
+// Like verify, but returns the full verdict so callers can tell why a share
+// was rejected.
+static napi_value Check(napi_env env, napi_callback_info info) {
+  size_t argc = 2;
+  napi_value argv[2];
+  std::shared_ptr<EhVerifier> verifier = GetCall(env, info, argc, argv);
+  if (!verifier)
+    return NULL;
+
+  if (argc < 2) {
+  napi_throw_type_error(env, NULL, "Wrong number of arguments");
+  return NULL;
+  }
+
+  const CBlockHeader *header;
+  const char *soln;
+  size_t solnLength;
+  if (!GetShare(env, argv, &header, &soln, &solnLength))
+    return NULL;
+
+  EhResult result = verifier->Check(header, soln, solnLength);
+  return NewResult(env, result);
+}
+
+
+// verifyShare(header, solution, target) checks the block hash of a share
+// against its target before the solution, so low difficulty shares never
+// reach Equihash. Returns the verdict of check() plus the block hash, for
+// spotting block candidates.
+static napi_value VerifyShare(napi_env env, napi_callback_info info) {
+  size_t argc = 3;
+  napi_value argv[3];
+  std::shared_ptr<EhVerifier> verifier = GetCall(env, info, argc, argv);
+  if (!verifier)
+    return NULL;
+
+  if (argc < 3) {
+  napi_throw_type_error(env, NULL, "Wrong number of arguments");
+  return NULL;
+  }
+
+  const CBlockHeader *header;
+  const char *soln;
+  size_t solnLength;
+  if (!GetShare(env, argv, &header, &soln, &solnLength))
+    return NULL;
+
+  if(!IsBuffer(env, argv[2])) {
+  napi_throw_type_error(env, NULL, "Arguments should be buffer objects.");
+  return NULL;
+  }
+
+  size_t targetLength;
+  const unsigned char *target = reinterpret_cast<const unsigned char*>(BufferData(env, argv[2], &targetLength));
+  if (targetLength != EhBlockHashLength) {
+  napi_throw_range_error(env, NULL, "Target should be 32 bytes long.");
+  return NULL;
+  }
+
+  unsigned char hash[EhBlockHashLength];
+  EhResult result = verifier->CheckShare(header, soln, solnLength, target, hash);
+
+  napi_value ret = NewResult(env, result);
+  if (result.reason != EhBadLength) {
+    napi_value hashBuffer;
+    napi_create_buffer_copy(env, sizeof(hash), hash, NULL, &hashBuffer);
+    napi_set_named_property(env, ret, "hash", hashBuffer);
+  }
+  return ret;
+}
+
+
+static napi_value VerifyBatch(napi_env env, napi_callback_info info) {
+  size_t argc = 2;
+  napi_value argv[2];
+  std::shared_ptr<EhVerifier> verifier = GetCall(env, info, argc, argv);
+  if (!verifier)
+    return NULL;
+
+  if (argc < 2) {
+  napi_throw_type_error(env, NULL, "Wrong number of arguments");
+  return NULL;
+  }
+
+  bool headersArray = false, solutionsArray = false;
+  napi_is_array(env, argv[0], &headersArray);
+  napi_is_array(env, argv[1], &solutionsArray);
+  if (!headersArray || !solutionsArray) {
+  napi_throw_type_error(env, NULL, "Arguments should be arrays of buffer objects.");
+  return NULL;
+  }
+
+  uint32_t count, solutionCount;
+  napi_get_array_length(env, argv[0], &count);
+  napi_get_array_length(env, argv[1], &solutionCount);
+
+  if (solutionCount != count) {
+  napi_throw_type_error(env, NULL, "Header and solution arrays should have the same length.");
+  return NULL;
+  }
+
+  std::vector<const CBlockHeader*> hdrs(count);
+  std::vector<const char*> solns(count);
+  std::vector<size_t> solnLens(count);
+  for (uint32_t i = 0; i < count; i++) {
+    napi_value header, solution;
+    napi_get_element(env, argv[0], i, &header);
+    napi_get_element(env, argv[1], i, &solution);
+    if(!IsBuffer(env, header) || !IsBuffer(env, solution)) {
+    napi_throw_type_error(env, NULL, "Arguments should be arrays of buffer objects.");
+    return NULL;
+    }
+    size_t hdrLength;
+    hdrs[i] = reinterpret_cast<const CBlockHeader*>(BufferData(env, header, &hdrLength));
+    if (hdrLength != sizeof(CBlockHeader)) {
+    napi_throw_range_error(env, NULL, "Header should be 140 bytes long.");
+    return NULL;
+    }
+    solns[i] = BufferData(env, solution, &solnLens[i]);
+  }
+
+  // One byte per share, 1 for a valid solution. Buffers are Uint8Arrays.
+  napi_value results;
+  void *data;
+  napi_create_buffer(env, count, &data, &results);
+  verifier->VerifyBatch(hdrs.data(), solns.data(), solnLens.data(), count,
+                        static_cast<uint8_t*>(data));
+  return results;
+}
+
+
+static napi_value VerifyAsync(napi_env env, napi_callback_info info) {
+  size_t argc = 3;
+  napi_value argv[3];
+  std::shared_ptr<EhVerifier> verifier = GetCall(env, info, argc, argv);
+  if (!verifier)
+    return NULL;
+
+  if (argc < 3) {
+  napi_throw_type_error(env, NULL, "Wrong number of arguments");
+  return NULL;
+  }
+
+  const CBlockHeader *header;
+  const char *soln;
+  size_t solnLength;
+  if (!GetShare(env, argv, &header, &soln, &solnLength))
+    return NULL;
+
+  if(!IsFunction(env, argv[2])) {
+  napi_throw_type_error(env, NULL, "Callback should be a function.");
+  return NULL;
+  }
+
+  AsyncVerifyJob *job = NewVerifyJob(env, verifier, argv[2]);
+  job->header = header;
+  SubmitVerifyJob(env, job, argv[0], argv[1]);
+  return NULL;
+}
+
+
+static napi_value PrepareJob(napi_env env, napi_callback_info info) {
+  size_t argc = 2;
+  napi_value argv[2];
+  std::shared_ptr<EhVerifier> verifier = GetCall(env, info, argc, argv);
+  if (!verifier)
+    return NULL;
+
+  if (argc < 2) {
+  napi_throw_type_error(env, NULL, "Wrong number of arguments");
+  return NULL;
+  }
+
+  std::string jobId;
+  if (!GetJobId(env, argv[0], jobId))
+    return NULL;
+
+  if(!IsBuffer(env, argv[1])) {
+  napi_throw_type_error(env, NULL, "Arguments should be buffer objects.");
+  return NULL;
+  }
+
+  // Only the part before the nonce is used, so a full header or just its
+  // first 108 bytes are both accepted.
+  size_t hdrLen;
+  const char *hdr = BufferData(env, argv[1], &hdrLen);
+  if (hdrLen < sizeof(((CBlockHeader*)0)->data)) {
+  napi_throw_range_error(env, NULL, "Header is too short.");
+  return NULL;
+  }
+
+  verifier->PrepareJob(jobId, reinterpret_cast<const CBlockHeader*>(hdr));
+  return NULL;
+}
+
+
+static napi_value VerifyJob(napi_env env, napi_callback_info info) {
+  size_t argc = 3;
+  napi_value argv[3];
+  std::shared_ptr<EhVerifier> verifier = GetCall(env, info, argc, argv);
+  if (!verifier)
+    return NULL;
+
+  if (argc < 3) {
+  napi_throw_type_error(env, NULL, "Wrong number of arguments");
+  return NULL;
+  }
+
+  EhMidstate midstate = GetJobShare(env, argv, *verifier);
+  if (!midstate)
+    return NULL;
+
+  const unsigned char *nonce = reinterpret_cast<const unsigned char*>(BufferData(env, argv[1]));
+  size_t solnLength;
+  const char *soln = BufferData(env, argv[2], &solnLength);
+
+  EhResult result = verifier->CheckNonce(midstate, nonce, soln, solnLength);
+  return NewBoolean(env, result.Valid());
+}
+
+
+static napi_value VerifyJobAsync(napi_env env, napi_callback_info info) {
+  size_t argc = 4;
+  napi_value argv[4];
+  std::shared_ptr<EhVerifier> verifier = GetCall(env, info, argc, argv);
+  if (!verifier)
+    return NULL;
+
+  if (argc < 4) {
+  napi_throw_type_error(env, NULL, "Wrong number of arguments");
+  return NULL;
+  }
+
+  if(!IsFunction(env, argv[3])) {
+  napi_throw_type_error(env, NULL, "Callback should be a function.");
+  return NULL;
+  }
+
+  EhMidstate midstate = GetJobShare(env, argv, *verifier);
+  if (!midstate)
+    return NULL;
+
+  AsyncVerifyJob *job = NewVerifyJob(env, verifier, argv[3]);
+  job->midstate = midstate;
+  job->nonce = reinterpret_cast<const unsigned char*>(BufferData(env, argv[1]));
+  SubmitVerifyJob(env, job, argv[1], argv[2]);
+  return NULL;
+}
+
+
+static napi_value RemoveJob(napi_env env, napi_callback_info info) {
+  size_t argc = 1;
+  napi_value argv[1];
+  std::shared_ptr<EhVerifier> verifier = GetCall(env, info, argc, argv);
+  if (!verifier)
+    return NULL;
+
+  std::string jobId;
+  if (argc < 1 || !GetJobId(env, argv[0], jobId))
+    return NULL;
+  verifier->RemoveJob(jobId);
+  return NULL;
+}
+
+
+static napi_value ClearJobs(napi_env env, napi_callback_info info) {
+  size_t argc = 0;
+  std::shared_ptr<EhVerifier> verifier = GetCall(env, info, argc, NULL);
+  if (verifier)
+    verifier->ClearJobs();
+  return NULL;
+}
+
+
+static napi_value Stats(napi_env env, napi_callback_info info) {
+  size_t argc = 0;
+  std::shared_ptr<EhVerifier> verifier = GetCall(env, info, argc, NULL);
+  if (!verifier)
+    return NULL;
+
+  const EhStats& stats = verifier->Stats();
+  napi_value result;
+  napi_create_object(env, &result);
+  napi_set_named_property(env, result, "hashesComputed",
+                          NewNumber(env, stats.hashesComputed.load(std::memory_order_relaxed)));
+  napi_set_named_property(env, result, "hashesSaved",
+                          NewNumber(env, stats.hashesSaved.load(std::memory_order_relaxed)));
+
+  // Shares checked by outcome, keyed like the reason strings of check().
+  napi_value results;
+  napi_create_object(env, &results);
+  for (int reason = 0; reason < EhReasonCount; reason++) {
+    napi_set_named_property(env, results, EhReasonName(EhReason(reason)),
+                            NewNumber(env, stats.results[reason].load(std::memory_order_relaxed)));
+  }
+  napi_set_named_property(env, result, "results", results);
+
+  unsigned int rounds = verifier->Parameters().k;
+  napi_value collisionRounds;
+  napi_create_array_with_length(env, rounds, &collisionRounds);
+  for (unsigned int round = 0; round < rounds; round++) {
+    napi_set_element(env, collisionRounds, round,
+                     NewNumber(env, stats.collisionRounds[round].load(std::memory_order_relaxed)));
+  }
+  napi_set_named_property(env, result, "collisionRounds", collisionRounds);
+  napi_set_named_property(env, result, "duplicates",
+                          NewNumber(env, stats.duplicates.load(std::memory_order_relaxed)));
+  return result;
+}
+
+
+// Reads a ring's slot count: a power of two up to EhShareRing::MaxSlots.
+static bool GetRingSlots(napi_env env, napi_value value, uint32_t *slots) {
+  if (!GetUint32(env, value, slots) || *slots == 0 || *slots > EhShareRing::MaxSlots ||
+      (*slots & (*slots - 1)) != 0) {
+  napi_throw_range_error(env, NULL, "Slot count should be a power of two up to 1048576.");
+  return false;
+  }
+  return true;
+}
+
+
+// shareRingBytes(slots) is the size of the SharedArrayBuffer that a ring of
+// that many slots needs for this verifier's solutions.
+static napi_value ShareRingBytes(napi_env env, napi_callback_info info) {
+  size_t argc = 1;
+  napi_value argv[1];
+  std::shared_ptr<EhVerifier> verifier = GetCall(env, info, argc, argv);
+  if (!verifier)
+    return NULL;
+
+  uint32_t slots;
+  if (argc < 1 || !GetRingSlots(env, argv[0], &slots))
+    return NULL;
+  return NewNumber(env, EhShareRing::Bytes(slots, verifier->Parameters().solutionSize));
+}
+
+
+static void CallRingSignal(napi_env env, napi_value signal, void *context, void *data) {
+  if (env == NULL)
+    return;
+  napi_value global, exception;
+  napi_get_global(env, &global);
+  if (napi_call_function(env, global, signal, 0, NULL, NULL) == napi_pending_exception) {
+    napi_get_and_clear_last_exception(env, &exception);
+    napi_fatal_exception(env, exception);
+  }
+}
 
-using namespace v8;
 
+// Runs when the environment that attached a ring goes away without closing
+// it, before its thread-safe functions are torn down.
+static void CloseRingAtExit(void *arg) {
+  std::shared_ptr<ShareRingEntry> entry;
+  {
+    std::lock_guard<std::mutex> guard(ringsLock);
+    auto it = rings.find(static_cast<ShareRingEntry*>(arg)->id);
+    if (it == rings.end())
+      return;
+    entry = it->second;
+    rings.erase(it);
+  }
+  entry->ring->Close();
+}
+
+
+// attachShareRing(memory, slots, signal) lays out a ring over memory, a
+// Uint8Array spanning a SharedArrayBuffer of shareRingBytes(slots) bytes,
+// and starts serving it with this verifier. signal is called on this thread
+// when results are published. Returns the ring id.
+static napi_value AttachShareRing(napi_env env, napi_callback_info info) {
+  size_t argc = 3;
+  napi_value argv[3];
+  std::shared_ptr<EhVerifier> verifier = GetCall(env, info, argc, argv);
+  if (!verifier)
+    return NULL;
+
+  if (argc < 3) {
+  napi_throw_type_error(env, NULL, "Wrong number of arguments");
+  return NULL;
+  }
 
-void Verify(const v8::FunctionCallbackInfo<Value>& args) {
-  Isolate* isolate = Isolate::GetCurrent();
-  HandleScope scope(isolate);
+  bool isTypedArray = false;
+  napi_is_typedarray(env, argv[0], &isTypedArray);
+  napi_typedarray_type type = napi_int8_array;
+  size_t length = 0, offset = 0;
+  void *data = NULL;
+  napi_value buffer = NULL;
+  if (isTypedArray)
+    napi_get_typedarray_info(env, argv[0], &type, &length, &data, &buffer, &offset);
+  // Pool threads use data until the ring is closed, which is only safe when
+  // the memory cannot be detached or transferred away: a SharedArrayBuffer.
+  if (type != napi_uint8_array || offset != 0 || !IsSharedArrayBuffer(env, buffer)) {
+  napi_throw_type_error(env, NULL, "Memory should be a Uint8Array over a whole SharedArrayBuffer.");
+  return NULL;
+  }
 
-  if (args.Length() < 2) {
-  isolate->ThrowException(Exception::TypeError(
-    String::NewFromUtf8(isolate, "Wrong number of arguments")));
-  return;
+  uint32_t slots;
+  if (!GetRingSlots(env, argv[1], &slots))
+    return NULL;
+  if (length != EhShareRing::Bytes(slots, verifier->Parameters().solutionSize)) {
+  napi_throw_range_error(env, NULL, "Memory should be shareRingBytes(slots) bytes long.");
+  return NULL;
   }
 
-  Local<Object> header = args[0]->ToObject();
-  Local<Object> solution = args[1]->ToObject();
+  if(!IsFunction(env, argv[2])) {
+  napi_throw_type_error(env, NULL, "Signal should be a function.");
+  return NULL;
+  }
 
-  if(!node::Buffer::HasInstance(header) || !node::Buffer::HasInstance(solution)) {
-  isolate->ThrowException(Exception::TypeError(
-    String::NewFromUtf8(isolate, "Arguments should be buffer objects.")));
-  return;
+  std::shared_ptr<ShareRingEntry> entry = std::make_shared<ShareRingEntry>();
+  entry->env = env;
+  napi_create_reference(env, argv[0], 1, &entry->memory);
+  napi_create_threadsafe_function(env, argv[2], NULL, NewString(env, "equihashverify:sharering"),
+                                  0, 1, NULL, NULL, NULL, CallRingSignal, &entry->signal);
+  napi_threadsafe_function signal = entry->signal;
+  {
+    std::lock_guard<std::mutex> guard(ringsLock);
+    entry->id = ++lastRingId;
+    entry->ring = std::make_shared<EhShareRing>(verifier, static_cast<unsigned char*>(data), slots,
+                                                entry->id, *GetPool(), [signal] {
+      napi_call_threadsafe_function(signal, NULL, napi_tsfn_nonblocking);
+    });
+    rings[entry->id] = entry;
   }
+  napi_add_env_cleanup_hook(env, CloseRingAtExit, entry.get());
+  return NewUint32(env, entry->id);
+}
 
-  const char *hdr = node::Buffer::Data(header);
-  const char *soln = node::Buffer::Data(solution);
 
-  bool result = verifyEH(reinterpret_cast<const CBlockHeader*>(hdr), soln);
-  args.GetReturnValue().Set(result);
+// kickShareRing(id) starts draining a ring whose Idle word a producer has
+// just cleared. Works from any environment; unknown ids are ignored.
+static napi_value KickShareRing(napi_env env, napi_callback_info info) {
+  size_t argc = 1;
+  napi_value argv[1];
+  napi_get_cb_info(env, info, &argc, argv, NULL, NULL);
+
+  uint32_t id;
+  if (argc < 1 || !GetUint32(env, argv[0], &id)) {
+  napi_throw_type_error(env, NULL, "Ring id should be an unsigned integer.");
+  return NULL;
+  }
 
+  std::shared_ptr<EhShareRing> ring;
+  {
+    std::lock_guard<std::mutex> guard(ringsLock);
+    auto it = rings.find(id);
+    if (it != rings.end())
+      ring = it->second->ring;
+  }
+  if (ring)
+    ring->Kick();
+  return NULL;
 }
 
 
-void Init(Handle<Object> exports) {
-  NODE_SET_METHOD(exports, "verify", Verify);
+// closeShareRing(id) stops serving a ring attached by this environment,
+// waiting for the shares being checked. Shares still queued are dropped.
+static napi_value CloseShareRing(napi_env env, napi_callback_info info) {
+  size_t argc = 1;
+  napi_value argv[1];
+  napi_get_cb_info(env, info, &argc, argv, NULL, NULL);
+
+  uint32_t id;
+  if (argc < 1 || !GetUint32(env, argv[0], &id)) {
+  napi_throw_type_error(env, NULL, "Ring id should be an unsigned integer.");
+  return NULL;
+  }
+
+  std::shared_ptr<ShareRingEntry> entry;
+  {
+    std::lock_guard<std::mutex> guard(ringsLock);
+    auto it = rings.find(id);
+    if (it == rings.end() || it->second->env != env) {
+    napi_throw_error(env, NULL, "Unknown ring id.");
+    return NULL;
+    }
+    entry = it->second;
+    rings.erase(it);
+  }
+  napi_remove_env_cleanup_hook(env, CloseRingAtExit, entry.get());
+  entry->ring->Close();
+  napi_release_threadsafe_function(entry->signal, napi_tsfn_release);
+  napi_delete_reference(env, entry->memory);
+  return NULL;
 }
 
-NODE_MODULE(equihashverify, Init)
+
+static void DeleteVerifierWrap(napi_env env, void *data, void *hint) {
+  delete static_cast<VerifierWrap*>(data);
+}
+
+
+// new Verifier(n, k[, personalization[, cacheSize]]) wraps an EhVerifier for
+// one registered (N, K) parameter set and personalization.
+static napi_value NewVerifier(napi_env env, napi_callback_info info) {
+  size_t argc = 4;
+  napi_value argv[4], self, newTarget;
+  napi_get_cb_info(env, info, &argc, argv, &self, NULL);
+
+  napi_get_new_target(env, info, &newTarget);
+  if (newTarget == NULL) {
+  napi_throw_type_error(env, NULL, "Verifier must be called with new");
+  return NULL;
+  }
+
+  uint32_t n, k;
+  if (argc < 2 || !GetUint32(env, argv[0], &n) || !GetUint32(env, argv[1], &k)) {
+  napi_throw_type_error(env, NULL, "N and K should be unsigned integers.");
+  return NULL;
+  }
+
+  const EhParameters *params = FindEhParameters(n, k);
+  if (params == NULL) {
+  napi_throw_range_error(env, NULL, "Unsupported Equihash parameters.");
+  return NULL;
+  }
+
+  std::string personalization = DefaultPersonalization;
+  napi_valuetype type = napi_undefined;
+  if (argc > 2)
+    napi_typeof(env, argv[2], &type);
+  if (type != napi_undefined) {
+    if (type != napi_string) {
+    napi_throw_type_error(env, NULL, "Personalization should be a string.");
+    return NULL;
+    }
+    GetString(env, argv[2], personalization);
+    if (personalization.empty() || personalization.size() > EhPersonalizationLength) {
+    napi_throw_range_error(env, NULL, "Personalization should be 1 to 8 bytes long.");
+    return NULL;
+    }
+  }
+
+  uint32_t cacheSize = 0;
+  type = napi_undefined;
+  if (argc > 3)
+    napi_typeof(env, argv[3], &type);
+  if (type != napi_undefined && !GetUint32(env, argv[3], &cacheSize)) {
+  napi_throw_type_error(env, NULL, "Cache size should be an unsigned integer.");
+  return NULL;
+  }
+
+  VerifierWrap *wrap = new VerifierWrap();
+  wrap->verifier = std::make_shared<EhVerifier>(*params, personalization, cacheSize);
+  napi_wrap(env, self, wrap, DeleteVerifierWrap, NULL, NULL);
+
+  napi_set_named_property(env, self, "n", NewUint32(env, params->n));
+  napi_set_named_property(env, self, "k", NewUint32(env, params->k));
+  napi_set_named_property(env, self, "solutionSize", NewUint32(env, params->solutionSize));
+  napi_set_named_property(env, self, "personalization",
+                          NewString(env, wrap->verifier->Personalization().c_str()));
+  return self;
+}
+
+
+static napi_value SetThreads(napi_env env, napi_callback_info info) {
+  size_t argc = 1;
+  napi_value argv[1];
+  napi_get_cb_info(env, info, &argc, argv, NULL, NULL);
+
+  uint32_t threads;
+  if (argc < 1 || !GetUint32(env, argv[0], &threads) || threads == 0) {
+  napi_throw_type_error(env, NULL, "Thread count should be a positive integer.");
+  return NULL;
+  }
+
+  std::lock_guard<std::mutex> guard(poolLock);
+  if (pool != NULL) {
+  napi_throw_error(env, NULL, "Thread count must be set before the first asynchronous verify.");
+  return NULL;
+  }
+
+  poolThreads = threads;
+  return NULL;
+}
+
+
+static napi_value GetThreads(napi_env env, napi_callback_info info) {
+  std::lock_guard<std::mutex> guard(poolLock);
+  size_t threads = pool != NULL ? pool->Size() :
+                   poolThreads > 0 ? poolThreads : WorkerPool::DefaultSize();
+  return NewUint32(env, threads);
+}
+
+
+// Lists the (N, K) pairs compiled into this build.
+static napi_value ParameterSets(napi_env env, napi_callback_info info) {
+  size_t count;
+  const EhParameters *sets = EhParameterSets(count);
+  napi_value result;
+  napi_create_array_with_length(env, count, &result);
+  for (size_t i = 0; i < count; i++) {
+    napi_value entry;
+    napi_create_object(env, &entry);
+    napi_set_named_property(env, entry, "n", NewUint32(env, sets[i].n));
+    napi_set_named_property(env, entry, "k", NewUint32(env, sets[i].k));
+    napi_set_named_property(env, entry, "solutionSize", NewUint32(env, sets[i].solutionSize));
+    napi_set_element(env, result, i, entry);
+  }
+  return result;
+}
+
+
+// The leaf hash backend in use and the self-test and benchmark results of
+// every backend compiled in.
+static napi_value Info(napi_env env, napi_callback_info info) {
+  const Blake2bBackendSelection& selection = Blake2bSelection();
+  const Blake2bBackend& selected = selection.backends[selection.selected];
+  napi_value result;
+  napi_create_object(env, &result);
+  napi_set_named_property(env, result, "backend", NewString(env, selected.name));
+  napi_set_named_property(env, result, "lanes", NewUint32(env, selected.lanes));
+  napi_set_named_property(env, result, "forced", NewBoolean(env, selection.forced));
+
+  napi_value backends;
+  napi_create_array_with_length(env, selection.count, &backends);
+  for (size_t i = 0; i < selection.count; i++) {
+    const Blake2bBackend& backend = selection.backends[i];
+    napi_value entry;
+    napi_create_object(env, &entry);
+    napi_set_named_property(env, entry, "name", NewString(env, backend.name));
+    napi_set_named_property(env, entry, "lanes", NewUint32(env, backend.lanes));
+    napi_set_named_property(env, entry, "supported", NewBoolean(env, backend.supported));
+    napi_set_named_property(env, entry, "correct", NewBoolean(env, backend.correct));
+    napi_set_named_property(env, entry, "nsPerHash", NewNumber(env, backend.nsPerHash));
+    napi_set_element(env, backends, i, entry);
+  }
+  napi_set_named_property(env, result, "backends", backends);
+  return result;
+}
+
+
+// Registered after the thread-safe function, so it runs before Node tears
+// that down (cleanup hooks run in reverse order): workers still busy with
+// jobs of this environment finish reading its buffers and stop using it
+// first.
+static void CloseCompletion(void *arg) {
+  Completion *completion = static_cast<Completion*>(arg);
+  std::unique_lock<std::mutex> guard(completion->lock);
+  completion->closed = true;
+  completion->idle.wait(guard, [completion] { return completion->running == 0; });
+}
+
+
+static void DeleteAddonData(napi_env env, void *data, void *hint) {
+  delete static_cast<AddonData*>(data);
+}
+
+
+NAPI_MODULE_INIT() {
+  // Self-tests and times the leaf hash backends now rather than on the
+  // first share.
+  Blake2bSelection();
+
+  AddonData *addon = new AddonData();
+  // The module level functions keep verifying every share: the share cache
+  // is only used by verifiers created with a cacheSize.
+  addon->defaultVerifier = std::make_shared<EhVerifier>(*FindEhParameters(DefaultN, DefaultK));
+  addon->completion = std::make_shared<Completion>();
+
+  napi_create_threadsafe_function(env, NULL, NULL, NewString(env, "equihashverify:completion"),
+                                  0, 1, NULL, NULL, addon, CallVerifyCallback,
+                                  &addon->completion->tsfn);
+  napi_unref_threadsafe_function(env, addon->completion->tsfn);
+  napi_add_env_cleanup_hook(env, CloseCompletion, addon->completion.get());
+  napi_set_instance_data(env, addon, DeleteAddonData, NULL);
+
+  void *method = &verifierMethod;
+  napi_property_descriptor methods[] = {
+    { "verify", NULL, Verify, NULL, NULL, NULL, methodAttributes, method },
+    { "check", NULL, Check, NULL, NULL, NULL, methodAttributes, method },
+    { "verifyShare", NULL, VerifyShare, NULL, NULL, NULL, methodAttributes, method },
+    { "verifyBatch", NULL, VerifyBatch, NULL, NULL, NULL, methodAttributes, method },
+    { "verifyAsync", NULL, VerifyAsync, NULL, NULL, NULL, methodAttributes, method },
+    { "prepareJob", NULL, PrepareJob, NULL, NULL, NULL, methodAttributes, method },
+    { "verifyJob", NULL, VerifyJob, NULL, NULL, NULL, methodAttributes, method },
+    { "verifyJobAsync", NULL, VerifyJobAsync, NULL, NULL, NULL, methodAttributes, method },
+    { "removeJob", NULL, RemoveJob, NULL, NULL, NULL, methodAttributes, method },
+    { "clearJobs", NULL, ClearJobs, NULL, NULL, NULL, methodAttributes, method },
+    { "stats", NULL, Stats, NULL, NULL, NULL, methodAttributes, method },
+    { "shareRingBytes", NULL, ShareRingBytes, NULL, NULL, NULL, methodAttributes, method },
+    { "attachShareRing", NULL, AttachShareRing, NULL, NULL, NULL, methodAttributes, method },
+  };
+  napi_value verifierClass;
+  napi_define_class(env, "Verifier", NAPI_AUTO_LENGTH, NewVerifier, NULL,
+                    sizeof(methods) / sizeof(methods[0]), methods, &verifierClass);
+
+  napi_property_attributes exported =
+    static_cast<napi_property_attributes>(methodAttributes | napi_enumerable);
+  napi_property_descriptor functions[] = {
+    { "Verifier", NULL, NULL, NULL, NULL, verifierClass, exported, NULL },
+    { "verify", NULL, Verify, NULL, NULL, NULL, exported, NULL },
+    { "check", NULL, Check, NULL, NULL, NULL, exported, NULL },
+    { "verifyShare", NULL, VerifyShare, NULL, NULL, NULL, exported, NULL },
+    { "verifyBatch", NULL, VerifyBatch, NULL, NULL, NULL, exported, NULL },
+    { "verifyAsync", NULL, VerifyAsync, NULL, NULL, NULL, exported, NULL },
+    { "prepareJob", NULL, PrepareJob, NULL, NULL, NULL, exported, NULL },
+    { "verifyJob", NULL, VerifyJob, NULL, NULL, NULL, exported, NULL },
+    { "verifyJobAsync", NULL, VerifyJobAsync, NULL, NULL, NULL, exported, NULL },
+    { "removeJob", NULL, RemoveJob, NULL, NULL, NULL, exported, NULL },
+    { "clearJobs", NULL, ClearJobs, NULL, NULL, NULL, exported, NULL },
+    { "stats", NULL, Stats, NULL, NULL, NULL, exported, NULL },
+    { "shareRingBytes", NULL, ShareRingBytes, NULL, NULL, NULL, exported, NULL },
+    { "attachShareRing", NULL, AttachShareRing, NULL, NULL, NULL, exported, NULL },
+    { "kickShareRing", NULL, KickShareRing, NULL, NULL, NULL, exported, NULL },
+    { "closeShareRing", NULL, CloseShareRing, NULL, NULL, NULL, exported, NULL },
+    { "setThreads", NULL, SetThreads, NULL, NULL, NULL, exported, NULL },
+    { "getThreads", NULL, GetThreads, NULL, NULL, NULL, exported, NULL },
+    { "parameterSets", NULL, ParameterSets, NULL, NULL, NULL, exported, NULL },
+    { "info", NULL, Info, NULL, NULL, NULL, exported, NULL },
+  };
+  napi_define_properties(env, exports, sizeof(functions) / sizeof(functions[0]), functions);
+  return exports;
+}
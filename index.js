@@ -1 +1,71 @@
-module.exports = require('bindings')('equihashverify.node');
\ No newline at end of file
+var ev = require('bindings')('equihashverify.node');
+var ShareRing = require('./sharering.js');
+var VerifyStream = require('./verifystream.js');
+
+// Wraps a native function taking `arity` arguments plus a callback so that
+// it returns a Promise for the result when no callback is given.
+function withPromise(nativeAsync, arity) {
+	return function () {
+		var args = Array.prototype.slice.call(arguments, 0, arity);
+		var callback = arguments[arity];
+		if (typeof callback === 'function')
+			return nativeAsync.apply(this, args.concat(callback));
+		var self = this;
+		return new Promise(function (resolve, reject) {
+			nativeAsync.apply(self, args.concat(function (err, result) {
+				if (err) reject(err);
+				else resolve(result);
+			}));
+		});
+	};
+}
+
+module.exports = ev;
+
+// verifyAsync(header, solution[, callback]) runs the check on the native
+// worker pool. Without a callback it returns a Promise for the result;
+// callbacks also receive the reason string that check() would report.
+module.exports.verifyAsync = withPromise(ev.verifyAsync, 2);
+ev.Verifier.prototype.verifyAsync = withPromise(ev.Verifier.prototype.verifyAsync, 2);
+
+// prepareJob(jobId, header) caches the BLAKE2b state over the header bytes
+// before the nonce; verifyJob(jobId, nonce, solution) and its async twin then
+// only absorb the 32-byte nonce.
+module.exports.verifyJobAsync = withPromise(ev.verifyJobAsync, 3);
+ev.Verifier.prototype.verifyJobAsync = withPromise(ev.Verifier.prototype.verifyJobAsync, 3);
+
+// createVerifier({n, k[, personalization][, cacheSize]}) returns a verifier
+// bound to one of the parameter sets listed by parameterSets(). The
+// personalization tag defaults to 'ZcashPoW'; forks use their own, such as
+// 'BgoldPoW'. A cacheSize above 0 turns on a cache of that many verified
+// shares that flags resubmissions; there is none by default.
+module.exports.createVerifier = function (options) {
+	return new ev.Verifier(options.n, options.k, options.personalization, options.cacheSize);
+};
+
+// createVerifyStream([options]) returns an object-mode Duplex stream: write
+// {header, solution, tag} records, read {tag, valid, reason, duplicate}
+// verdicts. Shares are checked by options.verifier, or by a verifier created
+// from options.n, options.k, options.personalization and options.cacheSize,
+// or by the default verifier, through a share ring. Verdicts come out in
+// write order unless options.ordered is false; options.highWaterMark
+// (default 64) bounds the shares in flight.
+module.exports.createVerifyStream = function (options) {
+	options = options || {};
+	var verifier = options.verifier || (options.n ? module.exports.createVerifier(options) : ev);
+	return new VerifyStream(verifier, options);
+};
+
+// createShareRing([options]) returns a ShareRing: shares are copied into a
+// SharedArrayBuffer ring and checked on the native pool, verdicts come back
+// through a second ring. options.verifier, n, k, personalization and
+// cacheSize choose the verifier as for createVerifyStream; options.slots (a
+// power of two, default 1024) sizes the rings; options.onResults(ring) is
+// called when verdicts are ready to read(). new ShareRing(ring.buffer) gives
+// another thread its own view of the same ring.
+module.exports.ShareRing = ShareRing;
+module.exports.createShareRing = function (options) {
+	options = options || {};
+	var verifier = options.verifier || (options.n ? module.exports.createVerifier(options) : ev);
+	return ShareRing.create(verifier, options.slots || 1024, options.onResults);
+};
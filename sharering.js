@@ -0,0 +1,134 @@
+var native = require('bindings')('equihashverify.node');
+
+// Words of the control block and sizes of the layout described in
+// src/equi/sharering.h.
+var SUBMIT_TAIL = 0, RESULT_TAIL = 32, RESULT_HEAD = 48;
+var IDLE = 64, SIGNALLED = 80, CREDITS = 96;
+var ID = 112, SLOT_COUNT = 113, SLOT_SIZE = 114, SOLUTION_SIZE = 115;
+var CONTROL_BYTES = 512, SLOT_HEADER_BYTES = 16, HEADER_BYTES = 140, RESULT_BYTES = 16;
+
+// EhReason by value.
+var REASONS = ['valid', 'badLength', 'aboveTarget', 'indexOrder', 'duplicateIndex', 'collision', 'nonZeroFinal'];
+
+var notify = Atomics.notify || Atomics.wake;
+
+// A view of a share ring over its SharedArrayBuffer. The ring is attached by
+// createShareRing(); views made from ring.buffer in other threads may submit
+// shares and read verdicts too.
+function ShareRing(buffer) {
+	this.buffer = buffer;
+	this._words = new Int32Array(buffer);
+	this._bytes = new Uint8Array(buffer);
+	this.id = this._words[ID];
+	this.slots = this._words[SLOT_COUNT];
+	this.solutionSize = this._words[SOLUTION_SIZE];
+	this._slotBytes = this._words[SLOT_SIZE];
+	this._results = CONTROL_BYTES + this.slots * this._slotBytes;
+}
+
+// Copies a share into the ring. tag is an unsigned 32-bit integer handed
+// back with the verdict. Returns false, without copying, when the ring holds
+// as many shares as it has slots, counting verdicts not read yet.
+ShareRing.prototype.submit = function (header, solution, tag) {
+	if (!Buffer.isBuffer(header) || !Buffer.isBuffer(solution))
+		throw new TypeError('Arguments should be buffer objects.');
+	if (header.length !== HEADER_BYTES)
+		throw new RangeError('Header should be 140 bytes long.');
+
+	var words = this._words;
+	if (Atomics.sub(words, CREDITS, 1) <= 0) {
+		Atomics.add(words, CREDITS, 1);
+		return false;
+	}
+
+	// The slot for position pos holds pos while it is free.
+	var pos, slot;
+	for (;;) {
+		pos = Atomics.load(words, SUBMIT_TAIL);
+		slot = (CONTROL_BYTES + (pos & (this.slots - 1)) * this._slotBytes) >> 2;
+		var diff = (Atomics.load(words, slot) - pos) | 0;
+		if (diff === 0 && Atomics.compareExchange(words, SUBMIT_TAIL, pos, (pos + 1) | 0) === pos)
+			break;
+		if (diff < 0) {
+			// Still being checked: verdicts of later shares were read first.
+			Atomics.add(words, CREDITS, 1);
+			return false;
+		}
+	}
+
+	// A solution too long for the slot is only recorded by its length, the
+	// ring rejects it as badLength like verify() does.
+	words[slot + 1] = tag >>> 0;
+	words[slot + 2] = solution.length;
+	this._bytes.set(header, slot * 4 + SLOT_HEADER_BYTES);
+	if (solution.length <= this.solutionSize)
+		this._bytes.set(solution, slot * 4 + SLOT_HEADER_BYTES + HEADER_BYTES);
+	Atomics.store(words, slot, (pos + 1) | 0);
+
+	if (Atomics.load(words, IDLE) === 1 && Atomics.compareExchange(words, IDLE, 1, 0) === 1)
+		native.kickShareRing(this.id);
+	return true;
+};
+
+// Takes up to max (default all) published verdicts off the result ring:
+// {tag, valid, reason[, round], duplicate} like check().
+ShareRing.prototype.read = function (max) {
+	var words = this._words;
+	var verdicts = [];
+	if (max === undefined)
+		max = Infinity;
+	while (verdicts.length < max) {
+		var pos = Atomics.load(words, RESULT_HEAD);
+		var slot = (this._results + (pos & (this.slots - 1)) * RESULT_BYTES) >> 2;
+		var diff = (Atomics.load(words, slot) - ((pos + 1) | 0)) | 0;
+		if (diff < 0)
+			break;
+		if (diff > 0 || Atomics.compareExchange(words, RESULT_HEAD, pos, (pos + 1) | 0) !== pos)
+			continue;
+
+		var reason = REASONS[this._bytes[slot * 4 + 8]];
+		var verdict = {tag: words[slot + 1] >>> 0, valid: reason === 'valid', reason: reason};
+		if (reason === 'collision')
+			verdict.round = this._bytes[slot * 4 + 9];
+		verdict.duplicate = this._bytes[slot * 4 + 10] === 1;
+		verdicts.push(verdict);
+
+		Atomics.store(words, slot, (pos + this.slots) | 0);
+		Atomics.add(words, CREDITS, 1);
+	}
+	return verdicts;
+};
+
+// Blocks until verdicts may be waiting or timeout milliseconds pass, for
+// consumers on worker threads; the main thread uses onResults instead.
+// Returns Atomics.wait's answer, or 'not-equal' when verdicts are waiting.
+ShareRing.prototype.wait = function (timeout) {
+	var tail = Atomics.load(this._words, RESULT_TAIL);
+	if (tail !== Atomics.load(this._words, RESULT_HEAD))
+		return 'not-equal';
+	return Atomics.wait(this._words, RESULT_TAIL, tail, timeout);
+};
+
+// Stops serving the ring. Only the thread that created it may close it, and
+// until it does the ring keeps that thread's event loop alive.
+ShareRing.prototype.close = function () {
+	native.closeShareRing(this.id);
+};
+
+// Attaches a new ring of slots (a power of two) slots to verifier. onResults
+// is called with the ring on this thread when verdicts are published; the
+// same moment wakes wait() in other threads.
+ShareRing.create = function (verifier, slots, onResults) {
+	var buffer = new SharedArrayBuffer(verifier.shareRingBytes(slots));
+	var ring;
+	verifier.attachShareRing(new Uint8Array(buffer), slots, function () {
+		Atomics.store(ring._words, SIGNALLED, 0);
+		notify(ring._words, RESULT_TAIL);
+		if (onResults)
+			onResults(ring);
+	});
+	ring = new ShareRing(buffer);
+	return ring;
+};
+
+module.exports = ShareRing;
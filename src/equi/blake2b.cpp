@@ -0,0 +1,141 @@
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Portable BLAKE2b, following the reference implementation in RFC 7693.
+
+#include "blake2b.h"
+#include "blake2b_impl.h"
+
+#include <cassert>
+#include <cstring>
+#include <endian.h>
+
+const uint64_t Blake2bIV[8] = {
+    0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL,
+    0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+    0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL,
+    0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL
+};
+
+static inline uint64_t rotr64(uint64_t x, unsigned int n)
+{
+    return (x >> n) | (x << (64 - n));
+}
+
+#define G(r, i, a, b, c, d)                       \
+    do {                                          \
+        a = a + b + m[Blake2bSigma[r][2*i]];      \
+        d = rotr64(d ^ a, 32);                    \
+        c = c + d;                                \
+        b = rotr64(b ^ c, 24);                    \
+        a = a + b + m[Blake2bSigma[r][2*i+1]];    \
+        d = rotr64(d ^ a, 16);                    \
+        c = c + d;                                \
+        b = rotr64(b ^ c, 63);                    \
+    } while (0)
+
+void Blake2bCompressWords(uint64_t h[8], const uint64_t m[16], uint64_t t, bool last)
+{
+    uint64_t v[16];
+    for (int i = 0; i < 8; i++) {
+        v[i] = h[i];
+        v[i+8] = Blake2bIV[i];
+    }
+    v[12] ^= t;
+    if (last)
+        v[14] = ~v[14];
+
+    for (int r = 0; r < 12; r++) {
+        G(r, 0, v[0], v[4], v[ 8], v[12]);
+        G(r, 1, v[1], v[5], v[ 9], v[13]);
+        G(r, 2, v[2], v[6], v[10], v[14]);
+        G(r, 3, v[3], v[7], v[11], v[15]);
+        G(r, 4, v[0], v[5], v[10], v[15]);
+        G(r, 5, v[1], v[6], v[11], v[12]);
+        G(r, 6, v[2], v[7], v[ 8], v[13]);
+        G(r, 7, v[3], v[4], v[ 9], v[14]);
+    }
+
+    for (int i = 0; i < 8; i++)
+        h[i] ^= v[i] ^ v[i+8];
+}
+
+#undef G
+
+void Blake2bLoadBlock(uint64_t m[16], const unsigned char block[Blake2bBlockBytes])
+{
+    for (int i = 0; i < 16; i++) {
+        uint64_t w;
+        memcpy(&w, block + 8*i, sizeof(w));
+        m[i] = le64toh(w);
+    }
+}
+
+void Blake2bStoreHash(const uint64_t h[8], unsigned char* out, size_t outlen)
+{
+    unsigned char bytes[Blake2bOutBytes];
+    for (int i = 0; i < 8; i++) {
+        uint64_t w = htole64(h[i]);
+        memcpy(bytes + 8*i, &w, sizeof(w));
+    }
+    memcpy(out, bytes, outlen);
+}
+
+void Blake2bCompress(uint64_t h[8], const unsigned char block[Blake2bBlockBytes],
+                     uint64_t t, bool last)
+{
+    uint64_t m[16];
+    Blake2bLoadBlock(m, block);
+    Blake2bCompressWords(h, m, t, last);
+}
+
+void Blake2bInit(Blake2bState& state, size_t outlen,
+                 const unsigned char personal[Blake2bPersonalBytes])
+{
+    assert(outlen > 0 && outlen <= Blake2bOutBytes);
+
+    // Parameter block: digest length, no key, fanout and depth of 1, no
+    // salt, then the personalization in the last 16 bytes.
+    unsigned char param[64] = {};
+    param[0] = outlen;
+    param[2] = 1;
+    param[3] = 1;
+    memcpy(param + 48, personal, Blake2bPersonalBytes);
+
+    for (int i = 0; i < 8; i++) {
+        uint64_t w;
+        memcpy(&w, param + 8*i, sizeof(w));
+        state.h[i] = Blake2bIV[i] ^ le64toh(w);
+    }
+    state.t = 0;
+    state.buflen = 0;
+    state.outlen = outlen;
+}
+
+void Blake2bUpdate(Blake2bState& state, const unsigned char* in, size_t inlen)
+{
+    while (inlen > 0) {
+        // The buffered block is only compressed once more input follows,
+        // since the final block has to be compressed with the last flag.
+        if (state.buflen == Blake2bBlockBytes) {
+            state.t += Blake2bBlockBytes;
+            Blake2bCompress(state.h, state.buf, state.t, false);
+            state.buflen = 0;
+        }
+        size_t fill = Blake2bBlockBytes - state.buflen;
+        if (fill > inlen)
+            fill = inlen;
+        memcpy(state.buf + state.buflen, in, fill);
+        state.buflen += fill;
+        in += fill;
+        inlen -= fill;
+    }
+}
+
+void Blake2bFinal(Blake2bState& state, unsigned char* out)
+{
+    state.t += state.buflen;
+    memset(state.buf + state.buflen, 0, Blake2bBlockBytes - state.buflen);
+    Blake2bCompress(state.h, state.buf, state.t, true);
+    Blake2bStoreHash(state.h, out, state.outlen);
+}
@@ -0,0 +1,71 @@
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BLAKE2B_H_INCLUDED
+#define BLAKE2B_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+// BLAKE2b (RFC 7693) without key or salt, as used by Equihash.
+//
+// Unlike libsodium, which keeps up to two blocks buffered, this state
+// compresses a block as soon as more input follows it. After a 140-byte
+// header the first block has therefore already been compressed and only
+// the last 12 bytes are buffered, which is what lets the leaf hashes below
+// finish with a single compression each.
+
+enum : size_t { Blake2bBlockBytes=128 };
+enum : size_t { Blake2bOutBytes=64 };
+enum : size_t { Blake2bPersonalBytes=16 };
+
+struct Blake2bState {
+    uint64_t h[8];
+    uint64_t t;   // Bytes compressed so far; Equihash inputs never carry.
+    unsigned char buf[Blake2bBlockBytes];
+    size_t buflen;
+    size_t outlen;
+};
+
+void Blake2bInit(Blake2bState& state, size_t outlen,
+                 const unsigned char personal[Blake2bPersonalBytes]);
+void Blake2bUpdate(Blake2bState& state, const unsigned char* in, size_t inlen);
+void Blake2bFinal(Blake2bState& state, unsigned char* out);
+
+void Blake2bCompress(uint64_t h[8], const unsigned char block[Blake2bBlockBytes],
+                     uint64_t t, bool last);
+
+// Finalises count copies of state, copy j after absorbing the little-endian
+// 32-bit word words[j], writing state.outlen bytes per copy to
+// out + j*state.outlen. Equivalent to Update+Final on each copy but, when
+// the word fits in the buffered block, hashes several copies at once with
+// the selected backend.
+void Blake2bFinalWords(const Blake2bState& state, const uint32_t* words,
+                       size_t count, unsigned char* out);
+
+// One implementation of Blake2bFinalWords.
+struct Blake2bBackend {
+    const char* name;   // "scalar", "sse4.1", "avx2" or "avx512".
+    size_t lanes;       // Copies hashed side by side.
+    bool supported;     // The CPU has the instructions it needs.
+    bool correct;       // Matched libsodium in the self-test.
+    double nsPerHash;   // Self-benchmark result; 0 unless correct.
+};
+
+struct Blake2bBackendSelection {
+    const Blake2bBackend* backends;
+    size_t count;
+    size_t selected;
+    // Chosen through EQUIHASHVERIFY_BACKEND rather than for its speed.
+    bool forced;
+};
+
+// The backends compiled into this build and the one in use. The first call
+// to this or to Blake2bFinalWords calls sodium_init(), checks every backend
+// the CPU supports against libsodium, times the correct ones on a few
+// hundred leaf hashes (well under a millisecond each) and picks the
+// fastest. Setting EQUIHASHVERIFY_BACKEND to the name of a correct backend
+// selects that one instead; other values are ignored.
+const Blake2bBackendSelection& Blake2bSelection();
+
+#endif
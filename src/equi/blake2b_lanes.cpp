@@ -0,0 +1,554 @@
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Lane-parallel finalisation of many BLAKE2b states that differ only in one
+// appended 32-bit word, which is exactly the Equihash leaf hash: every leaf
+// starts from the same header state and absorbs a different index.
+//
+// Each vector register holds the same state word for 2 (SSE4.1), 4 (AVX2)
+// or 8 (AVX-512) independent messages, so one pass through the compression
+// function hashes that many leaves. The engine is picked once at runtime:
+// every engine the CPU supports is checked against libsodium and timed, and
+// the fastest correct one is used.
+
+#include "blake2b.h"
+#include "blake2b_impl.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <endian.h>
+
+#include <sodium.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define EH_X86_LANES 1
+#include <immintrin.h>
+#endif
+
+namespace {
+
+inline uint64_t Rotr64(uint64_t x, unsigned int n)
+{
+    return (x >> n) | (x << (64 - n));
+}
+
+// One half of BLAKE2b's G, mixing in one message word: rotations 32 and 24
+// for the first half, 16 and 63 for the second.
+inline void HalfG(uint64_t& a, uint64_t& b, uint64_t& c, uint64_t& d, uint64_t m,
+                  unsigned int r1, unsigned int r2)
+{
+    a = a + b + m;
+    d = Rotr64(d ^ a, r1);
+    c = c + d;
+    b = Rotr64(b ^ c, r2);
+}
+
+// The final block shared by every copy: buffered bytes and zero padding,
+// plus where the appended word lands in it. It also holds the working
+// vector after every step of the compression that does not depend on the
+// word. The first round's column steps read m[0..7] in order, so a column
+// step that does not read the word is the same for every copy, and so is
+// the first half of one that reads it only in its second half. Everything
+// from the first diagonal step on depends on the word.
+struct FinalBlock {
+    uint64_t m[16];
+    size_t word;         // Message word receiving the low bits of the word.
+    unsigned int shift;  // Bit offset of the word inside m[word].
+    uint64_t t;
+    size_t outlen;
+    uint64_t v[16];
+    // Halves of each first-round column step already applied to v: 0, 1
+    // or 2.
+    unsigned char done[4];
+
+    FinalBlock(const Blake2bState& state)
+    {
+        unsigned char block[Blake2bBlockBytes] = {};
+        memcpy(block, state.buf, state.buflen);
+        Blake2bLoadBlock(m, block);
+        word = state.buflen / 8;
+        shift = (state.buflen % 8) * 8;
+        t = state.t + state.buflen + sizeof(uint32_t);
+        outlen = state.outlen;
+
+        for (int i = 0; i < 8; i++) {
+            v[i] = state.h[i];
+            v[i+8] = Blake2bIV[i];
+        }
+        v[12] ^= t;
+        v[14] = ~v[14];
+        for (size_t i = 0; i < 4; i++) {
+            done[i] = 0;
+            if (Varies(2*i))
+                continue;
+            HalfG(v[i], v[i+4], v[i+8], v[i+12], m[2*i], 32, 24);
+            done[i] = 1;
+            if (Varies(2*i+1))
+                continue;
+            HalfG(v[i], v[i+4], v[i+8], v[i+12], m[2*i+1], 16, 63);
+            done[i] = 2;
+        }
+    }
+
+    // A word starting in the last four bytes of m[word] spills into the next.
+    bool Straddles() const { return shift > 32; }
+    bool Varies(size_t w) const { return w == word || (Straddles() && w == word + 1); }
+
+    // The layout after a 140-byte header: the word fills the upper half of
+    // m[1], m[2..15] are zero and only the first column step of the first
+    // round has a half left to run.
+    bool LeafLayout() const { return word == 1 && shift == 32; }
+
+    uint64_t Low(uint32_t w) const { return m[word] | (uint64_t(w) << shift); }
+    uint64_t High(uint32_t w) const { return m[word+1] | (uint64_t(w) >> (64 - shift)); }
+};
+
+typedef void (*FinalWordsFn)(const Blake2bState& state, const FinalBlock& fb,
+                             const uint32_t* words, size_t count, unsigned char* out);
+
+// The engines share one body, written over a register type VEC holding
+// LANES 64-bit words with ADD, XOR and the ROTR macros defined by each
+// engine, so that the scalar engine is the one-lane case of it. Each engine
+// is instantiated twice: for any layout, and with Leaf set for the
+// FinalBlock::LeafLayout() of every Equihash leaf. The rounds are unrolled
+// so that every message index is a constant, which lets the Leaf
+// instantiation drop the additions of message words known to be zero, 14
+// of the 16.
+
+// a + m[s], unless m[s] is zero in the leaf layout.
+#define LANE_ADDM(a, s) (Leaf && (s) >= 2 ? (a) : ADD(a, m[s]))
+
+#define LANE_G1(r, i, a, b, c, d)                               \
+    do {                                                        \
+        a = LANE_ADDM(ADD(a, b), Blake2bSigma[r][2*i]);         \
+        d = ROTR32(XOR(d, a));                                  \
+        c = ADD(c, d);                                          \
+        b = ROTR24(XOR(b, c));                                  \
+    } while (0)
+
+#define LANE_G2(r, i, a, b, c, d)                               \
+    do {                                                        \
+        a = LANE_ADDM(ADD(a, b), Blake2bSigma[r][2*i+1]);       \
+        d = ROTR16(XOR(d, a));                                  \
+        c = ADD(c, d);                                          \
+        b = ROTR63(XOR(b, c));                                  \
+    } while (0)
+
+#define LANE_G(r, i, a, b, c, d)                                \
+    do {                                                        \
+        LANE_G1(r, i, a, b, c, d);                              \
+        LANE_G2(r, i, a, b, c, d);                              \
+    } while (0)
+
+// Column step i of the first round, less the halves in fb.v already.
+#define LANE_DONE(i) (Leaf ? (i == 0 ? 1 : 2) : fb.done[i])
+#define LANE_COLUMN(i)                                          \
+    do {                                                        \
+        if (LANE_DONE(i) == 0)                                  \
+            LANE_G1(0, i, v[i], v[i+4], v[i+8], v[i+12]);       \
+        if (LANE_DONE(i) < 2)                                   \
+            LANE_G2(0, i, v[i], v[i+4], v[i+8], v[i+12]);       \
+    } while (0)
+
+#define LANE_DIAGONALS(r)                                       \
+    do {                                                        \
+        LANE_G(r, 4, v[0], v[5], v[10], v[15]);                 \
+        LANE_G(r, 5, v[1], v[6], v[11], v[12]);                 \
+        LANE_G(r, 6, v[2], v[7], v[ 8], v[13]);                 \
+        LANE_G(r, 7, v[3], v[4], v[ 9], v[14]);                 \
+    } while (0)
+
+#define LANE_ROUND(r)                                           \
+    do {                                                        \
+        LANE_G(r, 0, v[0], v[4], v[ 8], v[12]);                 \
+        LANE_G(r, 1, v[1], v[5], v[ 9], v[13]);                 \
+        LANE_G(r, 2, v[2], v[6], v[10], v[14]);                 \
+        LANE_G(r, 3, v[3], v[7], v[11], v[15]);                 \
+        LANE_DIAGONALS(r);                                      \
+    } while (0)
+
+#define LANE_ROUNDS()                                           \
+    do {                                                        \
+        LANE_COLUMN(0);                                         \
+        LANE_COLUMN(1);                                         \
+        LANE_COLUMN(2);                                         \
+        LANE_COLUMN(3);                                         \
+        LANE_DIAGONALS(0);                                      \
+        LANE_ROUND(1);                                          \
+        LANE_ROUND(2);                                          \
+        LANE_ROUND(3);                                          \
+        LANE_ROUND(4);                                          \
+        LANE_ROUND(5);                                          \
+        LANE_ROUND(6);                                          \
+        LANE_ROUND(7);                                          \
+        LANE_ROUND(8);                                          \
+        LANE_ROUND(9);                                          \
+        LANE_ROUND(10);                                         \
+        LANE_ROUND(11);                                         \
+    } while (0)
+
+// SET1/LOADU/STOREU are the broadcast, load and store of VEC. Only the
+// message words holding the appended word change between batches.
+#define LANE_FINAL_WORDS(VEC, LANES, SET1, LOADU, STOREU)                     \
+    VEC m[16];                                                                \
+    for (int i = 0; i < 16; i++)                                              \
+        m[i] = SET1((long long)fb.m[i]);                                      \
+    for (size_t j = 0; j < count; j += LANES) {                               \
+        size_t n = count - j < LANES ? count - j : LANES;                     \
+        uint64_t lo[LANES], hi[LANES];                                        \
+        for (size_t l = 0; l < LANES; l++) {                                  \
+            uint32_t w = l < n ? words[j+l] : 0;                              \
+            lo[l] = fb.Low(w);                                                \
+            hi[l] = !Leaf && fb.Straddles() ? fb.High(w) : 0;                 \
+        }                                                                     \
+        m[Leaf ? 1 : fb.word] = LOADU(lo);                                    \
+        if (!Leaf && fb.Straddles())                                          \
+            m[fb.word+1] = LOADU(hi);                                         \
+                                                                              \
+        VEC v[16];                                                            \
+        for (int i = 0; i < 16; i++)                                          \
+            v[i] = SET1((long long)fb.v[i]);                                  \
+                                                                              \
+        LANE_ROUNDS();                                                        \
+                                                                              \
+        uint64_t h[8][LANES];                                                 \
+        for (int i = 0; i < 8; i++)                                           \
+            STOREU(h[i], XOR(SET1((long long)state.h[i]), XOR(v[i], v[i+8]))); \
+        for (size_t l = 0; l < n; l++) {                                      \
+            uint64_t lane[8];                                                 \
+            for (int i = 0; i < 8; i++)                                       \
+                lane[i] = h[i][l];                                            \
+            Blake2bStoreHash(lane, out + (j+l)*fb.outlen, fb.outlen);         \
+        }                                                                     \
+    }
+
+template<bool Leaf>
+void FinalWordsScalar(const Blake2bState& state, const FinalBlock& fb,
+                      const uint32_t* words, size_t count, unsigned char* out)
+{
+#define ADD(a, b) ((a) + (b))
+#define XOR(a, b) ((a) ^ (b))
+#define ROTR32(x) Rotr64(x, 32)
+#define ROTR24(x) Rotr64(x, 24)
+#define ROTR16(x) Rotr64(x, 16)
+#define ROTR63(x) Rotr64(x, 63)
+#define SET1(x) uint64_t(x)
+#define LOADU(p) (*(p))
+#define STOREU(p, x) (*(p) = (x))
+    LANE_FINAL_WORDS(uint64_t, 1, SET1, LOADU, STOREU)
+#undef ADD
+#undef XOR
+#undef ROTR32
+#undef ROTR24
+#undef ROTR16
+#undef ROTR63
+#undef SET1
+#undef LOADU
+#undef STOREU
+}
+
+#ifdef EH_X86_LANES
+
+template<bool Leaf>
+__attribute__((target("sse4.1")))
+void FinalWordsSse41(const Blake2bState& state, const FinalBlock& fb,
+                     const uint32_t* words, size_t count, unsigned char* out)
+{
+    const __m128i rot24 = _mm_setr_epi8(3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10);
+    const __m128i rot16 = _mm_setr_epi8(2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9);
+#define ADD(a, b) _mm_add_epi64(a, b)
+#define XOR(a, b) _mm_xor_si128(a, b)
+#define ROTR32(x) _mm_shuffle_epi32(x, _MM_SHUFFLE(2, 3, 0, 1))
+#define ROTR24(x) _mm_shuffle_epi8(x, rot24)
+#define ROTR16(x) _mm_shuffle_epi8(x, rot16)
+#define ROTR63(x) _mm_or_si128(_mm_srli_epi64(x, 63), _mm_add_epi64(x, x))
+#define LOADU(p) _mm_loadu_si128(reinterpret_cast<const __m128i*>(p))
+#define STOREU(p, x) _mm_storeu_si128(reinterpret_cast<__m128i*>(p), x)
+    LANE_FINAL_WORDS(__m128i, 2, _mm_set1_epi64x, LOADU, STOREU)
+#undef ADD
+#undef XOR
+#undef ROTR32
+#undef ROTR24
+#undef ROTR16
+#undef ROTR63
+#undef LOADU
+#undef STOREU
+}
+
+template<bool Leaf>
+__attribute__((target("avx2")))
+void FinalWordsAvx2(const Blake2bState& state, const FinalBlock& fb,
+                    const uint32_t* words, size_t count, unsigned char* out)
+{
+    const __m256i rot24 = _mm256_setr_epi8(3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10,
+                                           3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10);
+    const __m256i rot16 = _mm256_setr_epi8(2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9,
+                                           2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9);
+#define ADD(a, b) _mm256_add_epi64(a, b)
+#define XOR(a, b) _mm256_xor_si256(a, b)
+#define ROTR32(x) _mm256_shuffle_epi32(x, _MM_SHUFFLE(2, 3, 0, 1))
+#define ROTR24(x) _mm256_shuffle_epi8(x, rot24)
+#define ROTR16(x) _mm256_shuffle_epi8(x, rot16)
+#define ROTR63(x) _mm256_or_si256(_mm256_srli_epi64(x, 63), _mm256_add_epi64(x, x))
+#define LOADU(p) _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p))
+#define STOREU(p, x) _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), x)
+    LANE_FINAL_WORDS(__m256i, 4, _mm256_set1_epi64x, LOADU, STOREU)
+#undef ADD
+#undef XOR
+#undef ROTR32
+#undef ROTR24
+#undef ROTR16
+#undef ROTR63
+#undef LOADU
+#undef STOREU
+}
+
+template<bool Leaf>
+__attribute__((target("avx512f")))
+void FinalWordsAvx512(const Blake2bState& state, const FinalBlock& fb,
+                      const uint32_t* words, size_t count, unsigned char* out)
+{
+    // The all-lanes masked form is the same VPRORQ, but names its pass-through
+    // operand: GCC's _mm512_ror_epi64 passes an undefined one, which -Wextra
+    // reports once per rotation as '__Y' may be used uninitialized.
+#define ROTR(x, n) _mm512_mask_ror_epi64(x, 0xff, x, n)
+#define ADD(a, b) _mm512_add_epi64(a, b)
+#define XOR(a, b) _mm512_xor_si512(a, b)
+#define ROTR32(x) ROTR(x, 32)
+#define ROTR24(x) ROTR(x, 24)
+#define ROTR16(x) ROTR(x, 16)
+#define ROTR63(x) ROTR(x, 63)
+#define LOADU(p) _mm512_loadu_si512(p)
+#define STOREU(p, x) _mm512_storeu_si512(p, x)
+    LANE_FINAL_WORDS(__m512i, 8, _mm512_set1_epi64, LOADU, STOREU)
+#undef ROTR
+#undef ADD
+#undef XOR
+#undef ROTR32
+#undef ROTR24
+#undef ROTR16
+#undef ROTR63
+#undef LOADU
+#undef STOREU
+}
+
+#endif // EH_X86_LANES
+
+#undef LANE_FINAL_WORDS
+#undef LANE_ROUNDS
+#undef LANE_DIAGONALS
+#undef LANE_COLUMN
+#undef LANE_DONE
+#undef LANE_ROUND
+#undef LANE_G
+#undef LANE_G2
+#undef LANE_G1
+#undef LANE_ADDM
+
+bool Always()
+{
+    return true;
+}
+
+#ifdef EH_X86_LANES
+bool HasSse41()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.1");
+}
+
+bool HasAvx2()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+bool HasAvx512()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx512f");
+}
+#endif
+
+struct LaneEngine {
+    const char* name;
+    FinalWordsFn finalWords;
+    FinalWordsFn leafWords;
+    size_t lanes;
+    bool (*supported)();
+
+    void Run(const Blake2bState& state, const uint32_t* words, size_t count,
+             unsigned char* out) const
+    {
+        FinalBlock fb(state);
+        (fb.LeafLayout() ? leafWords : finalWords)(state, fb, words, count, out);
+    }
+};
+
+#define LANE_ENGINE(name, fn, lanes, supported) \
+    { name, fn<false>, fn<true>, lanes, supported }
+
+// Scalar first: it is the fallback when nothing else passes.
+const LaneEngine engines[] = {
+    LANE_ENGINE("scalar", FinalWordsScalar, 1, Always),
+#ifdef EH_X86_LANES
+    LANE_ENGINE("sse4.1", FinalWordsSse41, 2, HasSse41),
+    LANE_ENGINE("avx2", FinalWordsAvx2, 4, HasAvx2),
+    LANE_ENGINE("avx512", FinalWordsAvx512, 8, HasAvx512),
+#endif
+};
+
+#undef LANE_ENGINE
+
+enum : size_t { EngineCount=sizeof(engines) / sizeof(engines[0]) };
+
+// Leaf hashes of 200,9 are 50 bytes, so the self-test covers outputs that
+// end inside a state word. TestWords is not a multiple of any lane count,
+// which takes every engine through a partial batch too.
+enum : size_t { TestOutBytes=50 };
+enum : size_t { TestWords=19 };
+enum : size_t { BenchWords=256 };
+enum : int { BenchRuns=16 };
+
+void TestState(Blake2bState& state, size_t prefix, unsigned char* message,
+               unsigned char* personal)
+{
+    for (size_t i = 0; i < Blake2bPersonalBytes; i++)
+        personal[i] = 0xa5 ^ i;
+    for (size_t i = 0; i < prefix; i++)
+        message[i] = 7*i + 1;
+    Blake2bInit(state, TestOutBytes, personal);
+    Blake2bUpdate(state, message, prefix);
+}
+
+// Checks an engine against libsodium after prefixes that put the word in
+// each kind of place: after a 140-byte header (the upper half of m[1]),
+// straddling m[0] and m[1] or m[2] and m[3], in the last first-round
+// column step, among the words only the diagonal steps read, and in a
+// block with nothing compressed before it.
+bool SelfTest(const LaneEngine& engine)
+{
+    static const size_t prefixes[] = { 140, 133, 149, 188, 252, 44 };
+    for (size_t prefix : prefixes) {
+        Blake2bState state;
+        unsigned char message[252 + sizeof(uint32_t)];
+        unsigned char personal[Blake2bPersonalBytes];
+        TestState(state, prefix, message, personal);
+
+        uint32_t words[TestWords];
+        unsigned char out[TestWords*TestOutBytes];
+        for (size_t j = 0; j < TestWords; j++)
+            words[j] = 0x9e3779b9u * (j + 1);
+        engine.Run(state, words, TestWords, out);
+
+        for (size_t j = 0; j < TestWords; j++) {
+            uint32_t le = htole32(words[j]);
+            memcpy(message + prefix, &le, sizeof(le));
+            crypto_generichash_blake2b_state reference;
+            unsigned char expected[TestOutBytes];
+            crypto_generichash_blake2b_init_salt_personal(&reference, NULL, 0, TestOutBytes,
+                                                          NULL, personal);
+            crypto_generichash_blake2b_update(&reference, message, prefix + sizeof(le));
+            crypto_generichash_blake2b_final(&reference, expected, TestOutBytes);
+            if (memcmp(out + j*TestOutBytes, expected, TestOutBytes) != 0)
+                return false;
+        }
+    }
+    return true;
+}
+
+// Best of BenchRuns batches of BenchWords leaf hashes after a header.
+double NsPerHash(const LaneEngine& engine)
+{
+    Blake2bState state;
+    unsigned char message[140];
+    unsigned char personal[Blake2bPersonalBytes];
+    TestState(state, sizeof(message), message, personal);
+
+    uint32_t words[BenchWords];
+    unsigned char out[BenchWords*TestOutBytes];
+    for (size_t j = 0; j < BenchWords; j++)
+        words[j] = j;
+
+    // Once to warm up, then timed.
+    engine.Run(state, words, BenchWords, out);
+    double best = 0;
+    for (int run = 0; run < BenchRuns; run++) {
+        auto start = std::chrono::steady_clock::now();
+        engine.Run(state, words, BenchWords, out);
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        if (run == 0 || ns < best)
+            best = ns;
+    }
+    return best / BenchWords;
+}
+
+struct Selection {
+    Blake2bBackend backends[EngineCount];
+    Blake2bBackendSelection selection;
+    const LaneEngine* engine;
+
+    Selection()
+    {
+        // libsodium picks its own fastest implementations here. It is safe
+        // to call more than once and from several threads.
+        sodium_init();
+
+        const char* forced = getenv("EQUIHASHVERIFY_BACKEND");
+        size_t selected = 0;
+        bool byName = false;
+        for (size_t i = 0; i < EngineCount; i++) {
+            Blake2bBackend& backend = backends[i];
+            backend.name = engines[i].name;
+            backend.lanes = engines[i].lanes;
+            backend.supported = engines[i].supported();
+            backend.correct = backend.supported && SelfTest(engines[i]);
+            backend.nsPerHash = backend.correct ? NsPerHash(engines[i]) : 0;
+            if (!backend.correct || byName)
+                continue;
+            if (forced && strcmp(forced, backend.name) == 0) {
+                selected = i;
+                byName = true;
+            } else if (!backends[selected].correct || backend.nsPerHash < backends[selected].nsPerHash) {
+                selected = i;
+            }
+        }
+
+        selection.backends = backends;
+        selection.count = EngineCount;
+        selection.selected = selected;
+        selection.forced = byName;
+        engine = &engines[selected];
+    }
+};
+
+const Selection& Selected()
+{
+    static const Selection selected;
+    return selected;
+}
+
+} // namespace
+
+void Blake2bFinalWords(const Blake2bState& state, const uint32_t* words,
+                       size_t count, unsigned char* out)
+{
+    if (state.buflen + sizeof(uint32_t) > Blake2bBlockBytes) {
+        // The word would start a new block; take the generic path.
+        for (size_t j = 0; j < count; j++) {
+            Blake2bState copy = state;
+            uint32_t le = htole32(words[j]);
+            Blake2bUpdate(copy, reinterpret_cast<const unsigned char*>(&le), sizeof(le));
+            Blake2bFinal(copy, out + j*state.outlen);
+        }
+        return;
+    }
+
+    Selected().engine->Run(state, words, count, out);
+}
+
+const Blake2bBackendSelection& Blake2bSelection()
+{
+    return Selected().selection;
+}
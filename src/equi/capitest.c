@@ -0,0 +1,138 @@
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Replays a share corpus (format in bench/corpusbench.cpp) through the C
+// interface of libequi.h and fails on any verdict that differs from the
+// recorded one. It is plain C built with the flags pkg-config reports, so
+// `make check` catches a broken header, soname, export list or libequi.pc
+// as well as a wrong verdict.
+//
+//   capitest [corpus]
+
+#include <libequi.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum { CorpusHead = 16, RecordHead = 6 + EQUI_PERSONALIZATION_MAX + EQUI_HEADER_BYTES + 2 };
+
+static unsigned int ReadLE(const unsigned char* p, size_t bytes)
+{
+    unsigned int value = 0;
+    for (size_t i = bytes; i > 0; i--)
+        value = (value << 8) | p[i-1];
+    return value;
+}
+
+static unsigned char* ReadFile(const char* path, size_t* size)
+{
+    FILE* f = fopen(path, "rb");
+    if (!f)
+        return NULL;
+    unsigned char* bytes = NULL;
+    if (fseek(f, 0, SEEK_END) == 0) {
+        long end = ftell(f);
+        if (end > 0 && fseek(f, 0, SEEK_SET) == 0) {
+            bytes = malloc(end);
+            if (bytes && fread(bytes, 1, end, f) != (size_t)end) {
+                free(bytes);
+                bytes = NULL;
+            }
+            *size = end;
+        }
+    }
+    fclose(f);
+    return bytes;
+}
+
+static int Fail(const char* what, int status)
+{
+    fprintf(stderr, "capitest: %s: %s\n", what, equi_status_string(status));
+    return 1;
+}
+
+// Checks one record, then the same share again, which the verifier's cache
+// must answer with the same verdict. Shares of the wrong length are
+// rejected before the cache is consulted.
+static int CheckRecord(size_t i, const unsigned char* p, size_t solutionLen,
+                       const unsigned char* solution)
+{
+    unsigned int n = ReadLE(p, 2), k = p[2];
+    char personalization[EQUI_PERSONALIZATION_MAX + 1] = {0};
+    memcpy(personalization, p + 6, EQUI_PERSONALIZATION_MAX);
+    const unsigned char* header = p + 6 + EQUI_PERSONALIZATION_MAX;
+    equi_result expected = {p[4], p[4] == EQUI_COLLISION ? p[5] : 0, 0};
+
+    equi_verifier* verifier;
+    int status = equi_verifier_new(n, k, personalization, 16, &verifier);
+    if (status != EQUI_OK)
+        return Fail("equi_verifier_new", status);
+    int failed = 0;
+    for (unsigned int pass = 0; pass < 2 && !failed; pass++) {
+        equi_result result;
+        status = equi_check(verifier, header, solution, solutionLen, &result);
+        if (status != EQUI_OK) {
+            failed = Fail("equi_check", status);
+        } else if (result.reason != expected.reason || result.round != expected.round ||
+                   result.duplicate != (pass && expected.reason != EQUI_BAD_LENGTH)) {
+            const char* got = equi_reason_string(result.reason);
+            fprintf(stderr, "capitest: record %zu (%u,%u %s) pass %u: got %s@%u dup %u, "
+                    "expected %s@%u\n", i, n, k, personalization, pass,
+                    got ? got : "?", result.round, result.duplicate,
+                    equi_reason_string(expected.reason), expected.round);
+            failed = 1;
+        }
+    }
+    equi_verifier_free(verifier);
+    return failed;
+}
+
+int main(int argc, char** argv)
+{
+    const char* path = argc > 1 ? argv[1] : "../../bench/corpus.bin";
+    if (equi_abi_version() != EQUI_ABI_VERSION) {
+        fprintf(stderr, "capitest: compiled against ABI %u, loaded %u\n",
+                EQUI_ABI_VERSION, equi_abi_version());
+        return 1;
+    }
+
+    equi_verifier* verifier = NULL;
+    if (equi_verifier_new(1, 1, NULL, 0, &verifier) != EQUI_ERR_PARAMETERS || verifier ||
+            equi_verifier_new(96, 5, "TooLongTag", 0, &verifier) != EQUI_ERR_ARGUMENT ||
+            equi_check(NULL, NULL, NULL, 0, NULL) != EQUI_ERR_ARGUMENT) {
+        fprintf(stderr, "capitest: invalid arguments accepted\n");
+        return 1;
+    }
+
+    size_t size = 0;
+    unsigned char* bytes = ReadFile(path, &size);
+    if (!bytes || size < CorpusHead || memcmp(bytes, "EHCORPUS", 8) != 0 ||
+            ReadLE(bytes + 8, 4) != 1) {
+        fprintf(stderr, "capitest: cannot read corpus %s\n", path);
+        free(bytes);
+        return 1;
+    }
+    size_t count = ReadLE(bytes + 12, 4), pos = CorpusHead, failures = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (size - pos < RecordHead) {
+            fprintf(stderr, "capitest: corpus %s is truncated\n", path);
+            failures++;
+            break;
+        }
+        const unsigned char* p = bytes + pos;
+        size_t solutionLen = ReadLE(p + RecordHead - 2, 2);
+        if (size - pos - RecordHead < solutionLen) {
+            fprintf(stderr, "capitest: corpus %s is truncated\n", path);
+            failures++;
+            break;
+        }
+        failures += CheckRecord(i, p, solutionLen, p + RecordHead);
+        pos += RecordHead + solutionLen;
+    }
+    free(bytes);
+
+    printf("libequi %s (%s): %zu shares, %zu failed\n", equi_version(), equi_backend(),
+           count, failures);
+    return failures ? 1 : 0;
+}
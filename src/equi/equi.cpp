@@ -18,253 +18,310 @@
 #include <iostream>
 #include <stdexcept>
 
-int InitialiseState(eh_HashState& base_state)
+#include <sodium.h>
+
+const char DefaultPersonalization[EhPersonalizationLength+1] = "ZcashPoW";
+
+// personalization points at EhPersonalizationLength bytes.
+template<unsigned int N, unsigned int K>
+int Equihash<N,K>::InitialiseState(eh_HashState& base_state, const char *personalization)
 {
     uint32_t le_N = htole32(N);
     uint32_t le_K = htole32(K);
-    unsigned char personalization[crypto_generichash_blake2b_PERSONALBYTES] = {};
-    memcpy(personalization, "ZcashPoW", 8);
-    memcpy(personalization+8,  &le_N, 4);
-    memcpy(personalization+12, &le_K, 4);
-    return crypto_generichash_blake2b_init_salt_personal(&base_state,
-                                                         NULL, 0, // No key.
-                                                         (512/N)*N/8,
-                                                         NULL,    // No salt.
-                                                         personalization);
+    unsigned char personal[Blake2bPersonalBytes] = {};
+    memcpy(personal, personalization, EhPersonalizationLength);
+    memcpy(personal+8,  &le_N, 4);
+    memcpy(personal+12, &le_K, 4);
+    Blake2bInit(base_state, HashOutput, personal);
+    return 0;
 }
 
-void GenerateHash(const eh_HashState& base_state, eh_index g,
-                  unsigned char* hash, size_t hLen)
+// Reads the BITS bits at bit offset bit of a big-endian bit stream with one
+// unaligned 64-bit load. The 8 bytes from in + bit/8 must be readable.
+template<size_t BITS>
+static inline uint64_t ReadBits(const unsigned char* in, size_t bit)
 {
-    eh_HashState state;
-    state = base_state;
-    eh_index lei = htole32(g);
-    crypto_generichash_blake2b_update(&state, (const unsigned char*) &lei,
-                                      sizeof(eh_index));
-    crypto_generichash_blake2b_final(&state, hash, hLen);
+    static_assert(BITS + 7 <= 64, "BITS must fit in one 64-bit load");
+    uint64_t word;
+    memcpy(&word, in + bit/8, sizeof(word));
+    return (be64toh(word) >> (64 - BITS - bit%8)) & ((uint64_t(1) << BITS) - 1);
 }
 
-void ExpandArray(const unsigned char* in, size_t in_len,
-                 unsigned char* out, size_t out_len,
-                 size_t bit_len, size_t byte_pad)
+// Decodes count indices of BITS bits each from the big-endian bit stream
+// at minimal, the minimal encoding of a solution. Each index takes one load
+// and a shift; only the last few indices, whose load would run past the end
+// of the input, go through a zero-padded copy.
+template<size_t BITS>
+static void UnpackIndices(const unsigned char* minimal, size_t count, eh_index* indices)
 {
-    assert(bit_len >= 8);
-    assert(8*sizeof(uint32_t) >= 7+bit_len);
-
-    size_t out_width { (bit_len+7)/8 + byte_pad };
-    assert(out_len == 8*out_width*in_len/bit_len);
-
-    uint32_t bit_len_mask { ((uint32_t)1 << bit_len) - 1 };
-
-    // The acc_bits least-significant bits of acc_value represent a bit sequence
-    // in big-endian order.
-    size_t acc_bits = 0;
-    uint32_t acc_value = 0;
-
-    size_t j = 0;
-    for (size_t i = 0; i < in_len; i++) {
-        acc_value = (acc_value << 8) | in[i];
-        acc_bits += 8;
-
-        // When we have bit_len or more bits in the accumulator, write the next
-        // output element.
-        if (acc_bits >= bit_len) {
-            acc_bits -= bit_len;
-            for (size_t x = 0; x < byte_pad; x++) {
-                out[j+x] = 0;
-            }
-            for (size_t x = byte_pad; x < out_width; x++) {
-                out[j+x] = (
-                    // Big-endian
-                    acc_value >> (acc_bits+(8*(out_width-x-1)))
-                ) & (
-                    // Apply bit_len_mask across byte boundaries
-                    (bit_len_mask >> (8*(out_width-x-1))) & 0xFF
-                );
-            }
-            j += out_width;
-        }
+    static_assert(BITS <= 8*sizeof(eh_index), "Indices must fit in eh_index");
+    const size_t len = (count*BITS + 7) / 8;
+
+    size_t i = 0;
+    for (; i < count && (i*BITS)/8 + sizeof(uint64_t) <= len; i++)
+        indices[i] = ReadBits<BITS>(minimal, i*BITS);
+    for (; i < count; i++) {
+        unsigned char tail[sizeof(uint64_t)] = {};
+        memcpy(tail, minimal + (i*BITS)/8, len - (i*BITS)/8);
+        indices[i] = ReadBits<BITS>(tail, (i*BITS)%8);
     }
 }
 
-// Big-endian so that lexicographic array comparison is equivalent to integer
-// comparison
-void EhIndexToArray(const eh_index i, unsigned char* array)
+// Widens count chunks of BITS bits each, read from the big-endian bit
+// stream at in, to (BITS+7)/8 big-endian bytes each at out. Byte-aligned
+// widths (16 or 24 bits) are already laid out as the output and are copied. Other widths (20 bits for 200,9, 21 for
+// 210,9) take one ReadBits per chunk, so up to 7 bytes past the last input
+// byte may be read; the caller provides that slack.
+template<size_t BITS>
+static void ExpandChunks(const unsigned char* in, size_t count, unsigned char* out)
 {
-    eh_index bei = htobe32(i);
-    memcpy(array, &bei, sizeof(eh_index));
+    enum : size_t { Bytes=(BITS+7)/8 };
+    if (BITS % 8 == 0) {
+        memcpy(out, in, count*Bytes);
+        return;
+    }
+    for (size_t j = 0; j < count; j++) {
+        uint64_t v = ReadBits<BITS>(in, j*BITS);
+        for (size_t b = 0; b < Bytes; b++)
+            out[j*Bytes + b] = v >> (8*(Bytes-1-b));
+    }
 }
 
-// Big-endian so that lexicographic array comparison is equivalent to integer
-// comparison
-eh_index ArrayToEhIndex(const unsigned char* array)
+template<size_t WIDTH> template<size_t BITS>
+void HashRow<WIDTH>::ExpandLeaf(const unsigned char* hashIn, size_t chunks)
 {
-    eh_index bei;
-    memcpy(&bei, array, sizeof(eh_index));
-    return be32toh(bei);
+    assert(chunks*((BITS+7)/8) <= WIDTH);
+    words[Words-1] = 0;
+    ExpandChunks<BITS>(hashIn, chunks, reinterpret_cast<unsigned char*>(words));
 }
 
-eh_trunc TruncateIndex(const eh_index i, const unsigned int ilen)
+template<size_t WIDTH>
+bool HashRow<WIDTH>::IsZeroPrefix(size_t len) const
 {
-    // Truncate to 8 bits
-    return (i >> (ilen - 8)) & 0xff;
+    assert(len <= WIDTH);
+    // This doesn't need to be constant time, but it may as well be
+    // branch-free.
+    uint64_t acc = 0;
+    size_t w = 0;
+    for (; w < len/8; w++)
+        acc |= words[w];
+    if (len % 8)
+        acc |= le64toh(words[w]) & ((uint64_t(1) << (8*(len % 8))) - 1);
+    return acc == 0;
 }
 
-eh_index UntruncateIndex(const eh_trunc t, const eh_index r, const unsigned int ilen)
+template<unsigned int N, unsigned int K>
+EhResult Equihash<N,K>::IsValidSolution(const eh_HashState& base_state, const unsigned char *soln,
+                                    EhStats *stats)
 {
-    eh_index i{t};
-    return (i << (ilen - 8)) | r;
+    Work work;
+    UnpackSolution(soln, work);
+
+    // Structural checks come before any hashing, so that malformed
+    // solutions are turned away for the price of decoding them.
+    EhReason reason = CheckIndices(work);
+    if (reason != EhValid)
+        return reason;
+
+    HashLeaves(base_state, work);
+    if (stats) {
+        stats->hashesComputed.fetch_add(work.blockCount, std::memory_order_relaxed);
+        stats->hashesSaved.fetch_add((1 << K) - work.blockCount, std::memory_order_relaxed);
+    }
+
+    return CollapseTree(work);
 }
 
-std::vector<eh_index> GetIndicesFromMinimal(std::vector<unsigned char> minimal,
-                                            size_t cBitLen)
+template<unsigned int N, unsigned int K>
+void Equihash<N,K>::UnpackSolution(const unsigned char *soln, Work& work)
 {
-    assert(((cBitLen+1)+7)/8 <= sizeof(eh_index));
-    size_t lenIndices { 8*sizeof(eh_index)*minimal.size()/(cBitLen+1) };
-    size_t bytePad { sizeof(eh_index) - ((cBitLen+1)+7)/8 };
-    std::vector<unsigned char> array(lenIndices);
-    ExpandArray(minimal.data(), minimal.size(),
-                array.data(), lenIndices, cBitLen+1, bytePad);
-    std::vector<eh_index> ret;
-    for (int i = 0; i < lenIndices; i += sizeof(eh_index)) {
-        ret.push_back(ArrayToEhIndex(array.data()+i));
-    }
-    return ret;
+    UnpackIndices<CollisionBitLength+1>(soln, 1 << K, work.indices);
 }
 
-template<size_t WIDTH>
-StepRow<WIDTH>::StepRow(const unsigned char* hashIn, size_t hInLen,
-                        size_t hLen, size_t cBitLen)
+// Checks the ordering and distinctness of the indices and plans the leaf
+// hashes of a solution that passes.
+template<unsigned int N, unsigned int K>
+EhReason Equihash<N,K>::CheckIndices(Work& work)
 {
-    assert(hLen <= WIDTH);
-    ExpandArray(hashIn, hInLen, hash, hLen, cBitLen);
+    // With distinct indices, a subtree in canonical order starts with its
+    // smallest index. Comparing the first index of each pair of sibling
+    // subtrees therefore checks the ordering of the whole tree.
+    for (size_t width = 1; width < (1 << K); width *= 2) {
+        for (size_t i = 0; i < (1 << K); i += 2*width) {
+            if (work.indices[i+width] < work.indices[i])
+                return EhIndexOrder;
+        }
+    }
+
+    // Sorting (index, position) pairs puts equal indices next to each other.
+    // Any two leaves are siblings' descendants at some round, so an index
+    // repeated anywhere in the solution is a failure.
+    uint64_t* byIndex = work.byIndex;
+    for (size_t pos = 0; pos < (1 << K); pos++)
+        byIndex[pos] = (uint64_t(work.indices[pos]) << 16) | pos;
+    std::sort(byIndex, byIndex + (1 << K));
+    for (size_t j = 1; j < (1 << K); j++) {
+        if ((byIndex[j] >> 16) == (byIndex[j-1] >> 16))
+            return EhDuplicateIndex;
+    }
+
+    // Indices i and j share a BLAKE2b output when i/IndicesPerHashOutput ==
+    // j/IndicesPerHashOutput. The same order puts those next to each other,
+    // so every distinct output is generated once.
+    size_t computed = 0;
+    for (size_t j = 0; j < (1 << K); j++) {
+        eh_index i = byIndex[j] >> 16;
+        size_t pos = byIndex[j] & 0xffff;
+        eh_index block = i/IndicesPerHashOutput;
+        if (computed == 0 || block != work.blocks[computed-1])
+            work.blocks[computed++] = block;
+        work.leafOffset[pos] = (computed-1)*HashOutput + (i % IndicesPerHashOutput) * HashBytesPerIndex;
+    }
+    work.blockCount = computed;
+    return EhValid;
 }
 
-template<size_t WIDTH> template<size_t W>
-StepRow<WIDTH>::StepRow(const StepRow<W>& a)
+template<unsigned int N, unsigned int K>
+void Equihash<N,K>::HashLeaves(const eh_HashState& base_state, Work& work)
 {
-    std::copy(a.hash, a.hash+W, hash);
+    // All distinct outputs are generated in one call so that they can be
+    // spread over the lanes of the vector unit.
+    Blake2bFinalWords(base_state, work.blocks, work.blockCount, work.blockHashes);
+
+    // The rows only carry hash bytes: the indices were checked above and
+    // need no copying.
+    for (size_t pos = 0; pos < (1 << K); pos++)
+        work.rows[pos].template ExpandLeaf<CollisionBitLength>(work.blockHashes + work.leafOffset[pos], K+1);
 }
 
-template<size_t WIDTH>
-FullStepRow<WIDTH>::FullStepRow(const unsigned char* hashIn, size_t hInLen,
-                                size_t hLen, size_t cBitLen, eh_index i) :
-        StepRow<WIDTH> {hashIn, hInLen, hLen, cBitLen}
+template<unsigned int N, unsigned int K>
+EhResult Equihash<N,K>::CollapseTree(Work& work)
 {
-    EhIndexToArray(i, hash+hLen);
+    // The inputs of round r agree on their first r*CollisionByteLength
+    // bytes, so the pair collides exactly when the merged row is zero up to
+    // the end of the round's slice. Pair i/2 is written over row i/2, which
+    // has already been consumed; a failed pair leaves it overwritten, which
+    // does not matter as the share is rejected.
+    HashRow<HashLength>* X = work.rows;
+    for (unsigned int round = 0; round < K; round++) {
+        size_t rows = (1 << K) >> round;
+        for (size_t i = 0; i < rows; i += 2) {
+            X[i/2].Merge(X[i], X[i+1]);
+            if (!X[i/2].IsZeroPrefix((round+1)*CollisionByteLength))
+                return EhResult(EhCollision, round);
+        }
+    }
+
+    return X[0].IsZeroPrefix(HashLength) ? EhValid : EhNonZeroFinal;
 }
 
-template<size_t WIDTH> template<size_t W>
-FullStepRow<WIDTH>::FullStepRow(const FullStepRow<W>& a, const FullStepRow<W>& b, size_t len, size_t lenIndices, int trim) :
-        StepRow<WIDTH> {a}
+
+const char* EhReasonName(EhReason reason)
 {
-    assert(len+lenIndices <= W);
-    assert(len-trim+(2*lenIndices) <= WIDTH);
-    for (int i = trim; i < len; i++)
-        hash[i-trim] = a.hash[i] ^ b.hash[i];
-    if (a.IndicesBefore(b, len, lenIndices)) {
-        std::copy(a.hash+len, a.hash+len+lenIndices, hash+len-trim);
-        std::copy(b.hash+len, b.hash+len+lenIndices, hash+len-trim+lenIndices);
-    } else {
-        std::copy(b.hash+len, b.hash+len+lenIndices, hash+len-trim);
-        std::copy(a.hash+len, a.hash+len+lenIndices, hash+len-trim+lenIndices);
+    switch (reason) {
+    case EhValid: return "valid";
+    case EhBadLength: return "badLength";
+    case EhAboveTarget: return "aboveTarget";
+    case EhIndexOrder: return "indexOrder";
+    case EhDuplicateIndex: return "duplicateIndex";
+    case EhCollision: return "collision";
+    case EhNonZeroFinal: return "nonZeroFinal";
+    default: return "unknown";
     }
 }
 
-template<size_t WIDTH>
-FullStepRow<WIDTH>& FullStepRow<WIDTH>::operator=(const FullStepRow<WIDTH>& a)
+
+#define EH_INSTANTIATE(n, k) template class Equihash<n, k>;
+EH_PARAMETER_SETS(EH_INSTANTIATE)
+#undef EH_INSTANTIATE
+
+#define EH_PARAMETERS(n, k) \
+    { n, k, equihash_solution_size(n, k), \
+      &Equihash<n,k>::InitialiseState, &Equihash<n,k>::IsValidSolution },
+
+static const EhParameters ehParameterSets[] = {
+    EH_PARAMETER_SETS(EH_PARAMETERS)
+};
+
+#undef EH_PARAMETERS
+
+const EhParameters* FindEhParameters(unsigned int n, unsigned int k)
 {
-    std::copy(a.hash, a.hash+WIDTH, hash);
-    return *this;
+    for (const EhParameters& params : ehParameterSets) {
+        if (params.n == n && params.k == k)
+            return &params;
+    }
+    return NULL;
 }
 
-template<size_t WIDTH>
-bool StepRow<WIDTH>::IsZero(size_t len)
+const EhParameters* EhParameterSets(size_t& count)
 {
-    // This doesn't need to be constant time.
-    for (int i = 0; i < len; i++) {
-        if (hash[i] != 0)
-            return false;
-    }
-    return true;
+    count = sizeof(ehParameterSets) / sizeof(ehParameterSets[0]);
+    return ehParameterSets;
 }
 
 
-template<size_t WIDTH>
-bool HasCollision(StepRow<WIDTH>& a, StepRow<WIDTH>& b, int l)
+void AbsorbHeaderPrefix(eh_HashState& state, const CBlockHeader *header)
 {
-    // This doesn't need to be constant time.
-    for (int j = 0; j < l; j++) {
-        if (a.hash[j] != b.hash[j])
-            return false;
-    }
-    return true;
+  Blake2bUpdate(state, (const uint8_t*)&header->data, 108);
 }
 
-bool IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> &soln)
-
+void AbsorbNonce(eh_HashState& state, const unsigned char *nonce)
 {
-//    printf("Solution: ");
-    for (std::vector<unsigned char>::const_iterator i = soln.begin(); i != soln.end(); ++i){
-//       printf("%.2X", *i);
-    }
+  Blake2bUpdate(state, nonce, 32);
+}
 
-    //check already one in nomp code
-    //if (soln.size() != SolutionWidth) {
-    //	printf("invalid solution width");
-    //    return false;
-    //}
-
-    std::vector<FullStepRow<FinalFullWidth>> X;
-    X.reserve(1 << K);
-    unsigned char tmpHash[HashOutput];
-    for (eh_index i : GetIndicesFromMinimal(soln, CollisionBitLength)) {
-        GenerateHash(base_state, i/IndicesPerHashOutput, tmpHash, HashOutput);
-        X.emplace_back(tmpHash+((i % IndicesPerHashOutput) * N/8),
-                       N/8, HashLength, CollisionBitLength, i);
-    }
+void AbsorbHeader(eh_HashState& state, const CBlockHeader *header)
+{
+  AbsorbHeaderPrefix(state, header);
+  AbsorbNonce(state, header->nNonce.begin());
+}
 
-    size_t hashLen = HashLength;
-    size_t lenIndices = sizeof(eh_index);
-    while (X.size() > 1) {
-        std::vector<FullStepRow<FinalFullWidth>> Xc;
-        for (int i = 0; i < X.size(); i += 2) {
-            if (!HasCollision(X[i], X[i+1], CollisionByteLength)) {
-		printf("No Collision");
-                return false;
-            }
-            if (X[i+1].IndicesBefore(X[i], hashLen, lenIndices)) {
-		printf("IndicesBefore");
-                return false;
-            }
-            if (!DistinctIndices(X[i], X[i+1], hashLen, lenIndices)) {
-		printf("No distinct indices");
-                return false;
-            }
-            Xc.emplace_back(X[i], X[i+1], hashLen, lenIndices, CollisionByteLength);
-        }
-        X = Xc;
-        hashLen -= CollisionByteLength;
-        lenIndices *= 2;
-    }
+void EhBlockHash(const CBlockHeader *header, const char *soln, size_t solnLen,
+                 unsigned char hash[EhBlockHashLength])
+{
+  // Bitcoin's compact size: one byte below 253, else a marker byte and a
+  // little-endian 16- or 32-bit length.
+  unsigned char size[5];
+  size_t sizeLen;
+  if (solnLen < 253) {
+    size[0] = solnLen;
+    sizeLen = 1;
+  } else if (solnLen <= 0xffff) {
+    size[0] = 253;
+    size[1] = solnLen;
+    size[2] = solnLen >> 8;
+    sizeLen = 3;
+  } else {
+    size[0] = 254;
+    for (int i = 0; i < 4; i++)
+      size[1+i] = solnLen >> (8*i);
+    sizeLen = 5;
+  }
 
-    assert(X.size() == 1);
-    return X[0].IsZero(hashLen);
+  crypto_hash_sha256_state state;
+  crypto_hash_sha256_init(&state);
+  crypto_hash_sha256_update(&state, (const unsigned char*)header, sizeof(CBlockHeader));
+  crypto_hash_sha256_update(&state, size, sizeLen);
+  crypto_hash_sha256_update(&state, (const unsigned char*)soln, solnLen);
+  crypto_hash_sha256_final(&state, hash);
+  crypto_hash_sha256(hash, hash, EhBlockHashLength);
 }
 
-
-bool verifyEH(const CBlockHeader *header, const char *soln) {
-  crypto_generichash_blake2b_state state;
-  InitialiseState(state);
-  crypto_generichash_blake2b_update(&state, (const uint8_t*)&header->data, 108);
-  crypto_generichash_blake2b_update(&state, (const uint8_t*)header->nNonce.begin(),32);
-  std::vector<uint8_t> proofForCheck(soln, soln+equihash_solution_size(N,K));
-  std::vector<uint8_t> headers((const uint8_t*)header,(const uint8_t*)header+140);
-//  printf("Header: ");
-  for (std::vector<unsigned char>::const_iterator i = headers.begin(); i != headers.end(); ++i){
-//	printf("%.2X", *i);
+bool EhHashMeetsTarget(const unsigned char hash[EhBlockHashLength],
+                       const unsigned char target[EhBlockHashLength])
+{
+  for (size_t i = EhBlockHashLength; i-- > 0; ) {
+    if (hash[i] != target[i])
+      return hash[i] < target[i];
   }
-//  printf("\n");
-  return IsValidSolution(state, proofForCheck);
+  return true;
+}
 
+bool verifyEH(const CBlockHeader *header, const char *soln) {
+  typedef Equihash<DefaultN, DefaultK> Eh;
+  eh_HashState state;
+  Eh::InitialiseState(state, DefaultPersonalization);
+  AbsorbHeader(state, header);
+  return Eh::IsValidSolution(state, (const unsigned char*)soln, NULL).Valid();
 }
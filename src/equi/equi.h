@@ -8,7 +8,7 @@
 
 #include <string>
 
-#include "sodium.h"
+#include "blake2b.h"
 
 #include <cstring>
 #include <exception>
@@ -17,6 +17,8 @@
 #include <set>
 #include <vector>
 
+#include <atomic>
+
 #include <stdarg.h>
 #include "uint256.h"
 
@@ -34,136 +36,216 @@ struct CBlockHeader {
 };
 #pragma pack(pop)
 
-constexpr size_t max(const size_t A, const size_t B) { return A > B ? A : B; }
-
-typedef crypto_generichash_blake2b_state eh_HashState;
+typedef Blake2bState eh_HashState;
 typedef uint32_t eh_index;
-typedef uint8_t eh_trunc;
-
-unsigned const int N = 144;
-unsigned const int K = 5;
-enum : size_t { IndicesPerHashOutput=512/N };
-enum : size_t { HashOutput=IndicesPerHashOutput*N/8 };
-enum : size_t { CollisionBitLength=N/(K+1) };
-enum : size_t { CollisionByteLength=(CollisionBitLength+7)/8 };
-enum : size_t { HashLength=(K+1)*CollisionByteLength };
-enum : size_t { FullWidth=2*CollisionByteLength+sizeof(eh_index)*(1 << (K-1)) };
-enum : size_t { FinalFullWidth=2*CollisionByteLength+sizeof(eh_index)*(1 << (K)) };
-enum : size_t { TruncatedWidth=max(HashLength+sizeof(eh_trunc), 2*CollisionByteLength+sizeof(eh_trunc)*(1 << (K-1))) };
-enum : size_t { FinalTruncatedWidth=max(HashLength+sizeof(eh_trunc), 2*CollisionByteLength+sizeof(eh_trunc)*(1 << (K))) };
-enum : size_t { SolutionWidth=(1 << K)*(CollisionBitLength+1)/8 };
-
-void ExpandArray(const unsigned char* in, size_t in_len,
-                 unsigned char* out, size_t out_len,
-                 size_t bit_len, size_t byte_pad=0);
-
-eh_index ArrayToEhIndex(const unsigned char* array);
-eh_trunc TruncateIndex(const eh_index i, const unsigned int ilen);
-
-std::vector<eh_index> GetIndicesFromMinimal(std::vector<unsigned char> minimal,
-                                            size_t cBitLen);
 
+// Parameters used by the legacy verifyEH() entry point and by the module
+// level functions of the Node binding. Other parameter sets are reached
+// through the registry below.
+unsigned const int DefaultN = 144;
+unsigned const int DefaultK = 5;
+
+// The BLAKE2b personalization is this tag followed by little-endian N and K.
+// Forks of Zcash replace the tag ("BgoldPoW", ...) to separate their chains.
+enum : size_t { EhPersonalizationLength=8 };
+extern const char DefaultPersonalization[EhPersonalizationLength+1];
+
+// Row of the verifier's tree collapse, holding hash bytes only. A HashRow
+// keeps its full width on every merge and lets the collided prefix become
+// zero. Rows therefore stay aligned, and merge, collision and zero tests
+// run over whole 64-bit words. Bytes past WIDTH are kept zero.
 template<size_t WIDTH>
-class StepRow
+class HashRow
 {
-    template<size_t W>
-    friend class StepRow;
-    friend class CompareSR;
-
-protected:
-    unsigned char hash[WIDTH];
+    enum : size_t { Words=(WIDTH+7)/8 };
+    uint64_t words[Words];
 
 public:
-    StepRow(const unsigned char* hashIn, size_t hInLen,
-            size_t hLen, size_t cBitLen);
-    ~StepRow() { }
-
-    template<size_t W>
-    StepRow(const StepRow<W>& a);
-
-    bool IsZero(size_t len);
-    std::string GetHex(size_t len) { return HexStr(hash, hash+len); }
-
-    template<size_t W>
-    friend bool HasCollision(StepRow<W>& a, StepRow<W>& b, int l);
+    // Sets the row to the first chunks BITS-bit pieces of hashIn, each
+    // widened to whole bytes. May read up to 7 bytes past them.
+    template<size_t BITS>
+    void ExpandLeaf(const unsigned char* hashIn, size_t chunks);
+
+    // Sets this row to a XOR b. This row may be a, which is what lets a tree
+    // collapse run in place.
+    void Merge(const HashRow<WIDTH>& a, const HashRow<WIDTH>& b)
+    {
+        for (size_t w = 0; w < Words; w++)
+            words[w] = a.words[w] ^ b.words[w];
+    }
+
+    // True if the first len bytes are zero. After merging two rows of round
+    // r, that is (r+1)*CollisionByteLength bytes when the round collides.
+    bool IsZeroPrefix(size_t len) const;
 };
 
-class CompareSR
-{
-private:
-    size_t len;
-
-public:
-    CompareSR(size_t l) : len {l} { }
+constexpr size_t equihash_solution_size(unsigned int N, unsigned int K) {
+    return (1 << K)*(N/(K+1)+1)/8;
+}
 
-    template<size_t W>
-    inline bool operator()(const StepRow<W>& a, const StepRow<W>& b) { return memcmp(a.hash, b.hash, len) < 0; }
+// Largest K the verifier handles. Leaf positions are packed into 16 bits
+// while deduplicating leaf hashes.
+enum : unsigned int { EhMaxK=16 };
+
+// Why a solution was accepted or rejected. The checks run in this order, so
+// a solution that fails several of them reports the first.
+enum EhReason {
+    EhValid,
+    EhBadLength,        // Not exactly the solution size of the parameter set.
+    EhAboveTarget,      // Block hash above the share target (CheckShare only).
+    EhIndexOrder,       // A subtree's indices do not follow its sibling's.
+    EhDuplicateIndex,   // Two subtrees share an index.
+    EhCollision,        // Siblings do not collide; see EhResult::round.
+    EhNonZeroFinal,     // All rounds collide but the last XOR is not zero.
+    EhReasonCount
 };
 
-template<size_t WIDTH>
-bool HasCollision(StepRow<WIDTH>& a, StepRow<WIDTH>& b, int l);
+// Lower camel case name of a reason, as reported to JS.
+const char* EhReasonName(EhReason reason);
 
-template<size_t WIDTH>
-class FullStepRow : public StepRow<WIDTH>
-{
-    template<size_t W>
-    friend class FullStepRow;
+struct EhResult {
+    EhReason reason;
+    // Round of an EhCollision failure, counted from 0 for the leaves.
+    unsigned int round;
+    // Set when the verdict comes from an earlier submission of the same
+    // share rather than from checking it again.
+    bool duplicate;
 
-    using StepRow<WIDTH>::hash;
+    EhResult(EhReason r = EhValid, unsigned int rnd = 0) :
+        reason {r}, round {rnd}, duplicate {false} { }
 
-public:
-    FullStepRow(const unsigned char* hashIn, size_t hInLen,
-                size_t hLen, size_t cBitLen, eh_index i);
-    ~FullStepRow() { }
-
-    FullStepRow(const FullStepRow<WIDTH>& a) : StepRow<WIDTH> {a} { }
-    template<size_t W>
-    FullStepRow(const FullStepRow<W>& a, const FullStepRow<W>& b, size_t len, size_t lenIndices, int trim);
-    FullStepRow& operator=(const FullStepRow<WIDTH>& a);
-
-    inline bool IndicesBefore(const FullStepRow<WIDTH>& a, size_t len, size_t lenIndices) const { return memcmp(hash+len, a.hash+len, lenIndices) < 0; }
-    std::vector<unsigned char> GetIndices(size_t len, size_t lenIndices,
-                                          size_t cBitLen) const;
-
-    template<size_t W>
-    friend bool DistinctIndices(const FullStepRow<W>& a, const FullStepRow<W>& b,
-                                size_t len, size_t lenIndices);
-    template<size_t W>
-    friend bool IsValidBranch(const FullStepRow<W>& a, const size_t len, const unsigned int ilen, const eh_trunc t);
+    bool Valid() const { return reason == EhValid; }
 };
 
-template<size_t WIDTH>
-class TruncatedStepRow : public StepRow<WIDTH>
-{
-    template<size_t W>
-    friend class TruncatedStepRow;
+// Counters shared by every share checked through one verifier. They are
+// updated with relaxed atomics and meant for monitoring only.
+struct EhStats {
+    std::atomic<uint64_t> hashesComputed;
+    // Leaf hashes served from a BLAKE2b output already generated for
+    // another index of the same solution.
+    std::atomic<uint64_t> hashesSaved;
+    // Shares checked, by EhReason.
+    std::atomic<uint64_t> results[EhReasonCount];
+    // EhCollision failures, by round.
+    std::atomic<uint64_t> collisionRounds[EhMaxK];
+    // Shares answered from the share cache. They are not counted again in
+    // results or collisionRounds.
+    std::atomic<uint64_t> duplicates;
+
+    EhStats() : hashesComputed {0}, hashesSaved {0}, duplicates {0}
+    {
+        for (auto& count : results)
+            count.store(0, std::memory_order_relaxed);
+        for (auto& count : collisionRounds)
+            count.store(0, std::memory_order_relaxed);
+    }
+
+    void Record(const EhResult& result)
+    {
+        if (result.duplicate) {
+            duplicates.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        results[result.reason].fetch_add(1, std::memory_order_relaxed);
+        if (result.reason == EhCollision)
+            collisionRounds[result.round].fetch_add(1, std::memory_order_relaxed);
+    }
+};
 
-    using StepRow<WIDTH>::hash;
+template<unsigned int N, unsigned int K>
+class Equihash
+{
+    static_assert(K < N, "K must be less than N");
+    static_assert(K <= EhMaxK, "K must be at most EhMaxK");
+    static_assert((N/(K+1)) + 1 < 8*sizeof(eh_index), "Indices must fit in eh_index");
 
 public:
-    TruncatedStepRow(const unsigned char* hashIn, size_t hInLen,
-                     size_t hLen, size_t cBitLen,
-                     eh_index i, unsigned int ilen);
-    ~TruncatedStepRow() { }
-
-    TruncatedStepRow(const TruncatedStepRow<WIDTH>& a) : StepRow<WIDTH> {a} { }
-    template<size_t W>
-    TruncatedStepRow(const TruncatedStepRow<W>& a, const TruncatedStepRow<W>& b, size_t len, size_t lenIndices, int trim);
-    TruncatedStepRow& operator=(const TruncatedStepRow<WIDTH>& a);
-
-    inline bool IndicesBefore(const TruncatedStepRow<WIDTH>& a, size_t len, size_t lenIndices) const { return memcmp(hash+len, a.hash+len, lenIndices) < 0; }
-    std::shared_ptr<eh_trunc> GetTruncatedIndices(size_t len, size_t lenIndices) const;
+    enum : size_t { IndicesPerHashOutput=512/N };
+    // Each index takes the first N bits of its slice of the BLAKE2b output,
+    // rounded up to whole bytes when N is not a multiple of 8. For 210,9
+    // that is 27-byte slices of a 54-byte output, the layout of Aion's
+    // Equihash 210,9 reference (indicesHashLength = (n+7)/8). Zcash's
+    // N*(512/N)/8 bytes with N/8-byte slices only works for N divisible by
+    // 8: for 210,9 a slice would hold 208 bits of a 210-bit leaf, and the
+    // original leaf expansion asserted on it. When N is a multiple of 8 both
+    // layouts are the same.
+    enum : size_t { HashBytesPerIndex=(N+7)/8 };
+    static_assert(N % 8 != 0 || HashBytesPerIndex*IndicesPerHashOutput == N*(512/N)/8,
+                  "byte-aligned N keeps Zcash's hash layout");
+    enum : size_t { HashOutput=IndicesPerHashOutput*HashBytesPerIndex };
+    enum : size_t { CollisionBitLength=N/(K+1) };
+    enum : size_t { CollisionByteLength=(CollisionBitLength+7)/8 };
+    enum : size_t { HashLength=(K+1)*CollisionByteLength };
+    enum : size_t { SolutionWidth=(1 << K)*(CollisionBitLength+1)/8 };
+
+    // Scratch space of one check. IsValidSolution keeps it on the stack, so
+    // checking a share never touches the heap.
+    struct Work {
+        eh_index indices[1 << K];
+        // (index << 16 | position) pairs, sorted.
+        uint64_t byIndex[1 << K];
+        // The distinct BLAKE2b outputs the leaves need, and where each
+        // leaf's slice starts in blockHashes.
+        eh_index blocks[1 << K];
+        size_t blockCount;
+        size_t leafOffset[1 << K];
+        // ExpandLeaf may read a few bytes past the last leaf.
+        unsigned char blockHashes[(1 << K)*HashOutput + sizeof(uint64_t)];
+        HashRow<HashLength> rows[1 << K];
+    };
+
+    static int InitialiseState(eh_HashState& base_state, const char *personalization);
+    // soln must hold SolutionWidth bytes; stats may be NULL. Only the hash
+    // counters of stats are updated, results are recorded by the caller.
+    static EhResult IsValidSolution(const eh_HashState& base_state, const unsigned char *soln,
+                                EhStats *stats);
+
+    // The stages of IsValidSolution, in order. Each reads what the previous
+    // one left in work; they are public so that they can be timed alone.
+    static void UnpackSolution(const unsigned char *soln, Work& work);
+    static EhReason CheckIndices(Work& work);
+    static void HashLeaves(const eh_HashState& base_state, Work& work);
+    static EhResult CollapseTree(Work& work);
 };
 
+// The parameter sets compiled into this build, as X(N, K) entries. Adding
+// one here adds it to the registry below.
+#define EH_PARAMETER_SETS(X) \
+    X(144, 5) X(200, 9) X(192, 7) X(96, 5) X(210, 9)
+
+typedef int (*EhInitialiser)(eh_HashState& base_state, const char *personalization);
+typedef EhResult (*EhValidator)(const eh_HashState& base_state, const unsigned char *soln,
+                            EhStats *stats);
+
+// One entry of the parameter registry. Every entry points at its own
+// compile-time specialisation of Equihash<N,K>, so choosing a parameter set
+// at runtime costs one indirect call per share.
+struct EhParameters {
+    unsigned int n;
+    unsigned int k;
+    size_t solutionSize;
+    EhInitialiser initialiseState;
+    EhValidator isValidSolution;
+};
 
-
-constexpr size_t equihash_solution_size(unsigned int N, unsigned int K) {
-    return (1 << K)*(N/(K+1)+1)/8;
-}
-
-int InitialiseState(eh_HashState& base_state);
-bool IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> &soln);
+// Returns NULL when (n, k) is not compiled into this build.
+const EhParameters* FindEhParameters(unsigned int n, unsigned int k);
+const EhParameters* EhParameterSets(size_t& count);
+
+// AbsorbHeader is AbsorbHeaderPrefix followed by AbsorbNonce.
+void AbsorbHeader(eh_HashState& state, const CBlockHeader *header);
+void AbsorbHeaderPrefix(eh_HashState& state, const CBlockHeader *header);
+void AbsorbNonce(eh_HashState& state, const unsigned char *nonce);
+
+enum : size_t { EhBlockHashLength=32 };
+// Double SHA-256 over the header, the compact-size length of the solution
+// and the solution, i.e. the hash of the block the share would make. Like
+// the hashes in the header it is a little-endian 256-bit number.
+void EhBlockHash(const CBlockHeader *header, const char *soln, size_t solnLen,
+                 unsigned char hash[EhBlockHashLength]);
+// True if hash is at most target, both little-endian 256-bit numbers.
+bool EhHashMeetsTarget(const unsigned char hash[EhBlockHashLength],
+                       const unsigned char target[EhBlockHashLength]);
 bool verifyEH(const CBlockHeader *header, const char *soln);
-#include "equihash.tcc"
 
 #endif
@@ -0,0 +1,279 @@
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "libequi.h"
+#include "verifier.h"
+
+#include <cstring>
+#include <new>
+
+// The C and C++ constants live in unrelated enums, so compare them as
+// integers.
+static_assert(size_t(EQUI_HEADER_BYTES) == sizeof(CBlockHeader), "header size");
+static_assert(size_t(EQUI_NONCE_BYTES) == sizeof(uint256), "nonce size");
+static_assert(size_t(EQUI_HASH_BYTES) == size_t(EhBlockHashLength), "block hash size");
+static_assert(size_t(EQUI_PERSONALIZATION_MAX) == size_t(EhPersonalizationLength),
+              "personalization size");
+static_assert(size_t(EQUI_MAX_K) == size_t(EhMaxK), "collision round count");
+static_assert(int(EQUI_REASON_COUNT) == int(EhReasonCount) &&
+              int(EQUI_NONZERO_FINAL) == int(EhNonZeroFinal),
+              "equi_reason follows EhReason");
+
+struct equi_verifier {
+    EhVerifier verifier;
+
+    equi_verifier(const EhParameters& params, const std::string& personalization,
+                  size_t cacheEntries) :
+            verifier {params, personalization, cacheEntries}
+    {
+    }
+};
+
+// Runs f, turning the exceptions C++ may raise into status codes: none may
+// unwind into the caller's C, Go or Rust frames.
+template<typename F>
+static int Guard(F f)
+{
+    try {
+        return f();
+    } catch (const std::bad_alloc&) {
+        return EQUI_ERR_NO_MEMORY;
+    } catch (...) {
+        return EQUI_ERR_INTERNAL;
+    }
+}
+
+static void SetResult(equi_result* out, const EhResult& result)
+{
+    out->reason = result.reason;
+    out->round = result.round;
+    out->duplicate = result.duplicate ? 1 : 0;
+}
+
+static const CBlockHeader* AsHeader(const unsigned char* header)
+{
+    return reinterpret_cast<const CBlockHeader*>(header);
+}
+
+static bool AllSet(const unsigned char* const* pointers, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        if (pointers[i] == NULL)
+            return false;
+    }
+    return true;
+}
+
+unsigned int equi_abi_version(void)
+{
+    return EQUI_ABI_VERSION;
+}
+
+#define EQUI_STRING(x) #x
+#define EQUI_VERSION_STRING(major, minor, patch) \
+    EQUI_STRING(major) "." EQUI_STRING(minor) "." EQUI_STRING(patch)
+
+const char* equi_version(void)
+{
+    return EQUI_VERSION_STRING(EQUI_VERSION_MAJOR, EQUI_VERSION_MINOR, EQUI_VERSION_PATCH);
+}
+
+#undef EQUI_VERSION_STRING
+#undef EQUI_STRING
+
+const char* equi_status_string(int status)
+{
+    switch (status) {
+    case EQUI_OK: return "ok";
+    case EQUI_ERR_ARGUMENT: return "invalid argument";
+    case EQUI_ERR_PARAMETERS: return "unsupported Equihash parameters";
+    case EQUI_ERR_NO_MEMORY: return "out of memory";
+    case EQUI_ERR_UNKNOWN_JOB: return "unknown job";
+    case EQUI_ERR_INTERNAL: return "internal error";
+    default: return "unknown status";
+    }
+}
+
+const char* equi_reason_string(int reason)
+{
+    if (reason < 0 || size_t(reason) >= size_t(EhReasonCount))
+        return NULL;
+    return EhReasonName(EhReason(reason));
+}
+
+const char* equi_backend(void)
+{
+    const Blake2bBackendSelection& selection = Blake2bSelection();
+    return selection.backends[selection.selected].name;
+}
+
+size_t equi_solution_size(unsigned int n, unsigned int k)
+{
+    const EhParameters* params = FindEhParameters(n, k);
+    return params ? params->solutionSize : 0;
+}
+
+int equi_verifier_new(unsigned int n, unsigned int k, const char* personalization,
+                      size_t cache_entries, equi_verifier** verifier)
+{
+    if (verifier == NULL)
+        return EQUI_ERR_ARGUMENT;
+    *verifier = NULL;
+    if (personalization == NULL)
+        personalization = DefaultPersonalization;
+    size_t personalLen = strnlen(personalization, EhPersonalizationLength + 1);
+    if (personalLen == 0 || personalLen > EhPersonalizationLength)
+        return EQUI_ERR_ARGUMENT;
+    const EhParameters* params = FindEhParameters(n, k);
+    if (params == NULL)
+        return EQUI_ERR_PARAMETERS;
+
+    return Guard([&]() -> int {
+        // The backend self-test runs here rather than on the first share.
+        Blake2bSelection();
+        *verifier = new equi_verifier(*params, std::string(personalization, personalLen),
+                                      cache_entries);
+        return EQUI_OK;
+    });
+}
+
+void equi_verifier_free(equi_verifier* verifier)
+{
+    delete verifier;
+}
+
+size_t equi_verifier_solution_size(const equi_verifier* verifier)
+{
+    return verifier ? verifier->verifier.Parameters().solutionSize : 0;
+}
+
+int equi_check(const equi_verifier* verifier, const unsigned char* header,
+               const unsigned char* solution, size_t solution_len,
+               equi_result* result)
+{
+    if (!verifier || !header || !solution || !result)
+        return EQUI_ERR_ARGUMENT;
+    return Guard([&]() -> int {
+        SetResult(result, verifier->verifier.Check(AsHeader(header), (const char*)solution,
+                                                   solution_len));
+        return EQUI_OK;
+    });
+}
+
+int equi_check_share(const equi_verifier* verifier, const unsigned char* header,
+                     const unsigned char* solution, size_t solution_len,
+                     const unsigned char* target, unsigned char* hash,
+                     equi_result* result)
+{
+    if (!verifier || !header || !solution || !target || !result)
+        return EQUI_ERR_ARGUMENT;
+    return Guard([&]() -> int {
+        unsigned char blockHash[EhBlockHashLength];
+        SetResult(result, verifier->verifier.CheckShare(AsHeader(header), (const char*)solution,
+                                                        solution_len, target,
+                                                        hash ? hash : blockHash));
+        return EQUI_OK;
+    });
+}
+
+int equi_check_batch(const equi_verifier* verifier,
+                     const unsigned char* const* headers,
+                     const unsigned char* const* solutions,
+                     const size_t* solution_lens, size_t count,
+                     equi_result* results)
+{
+    if (count == 0)
+        return verifier ? EQUI_OK : EQUI_ERR_ARGUMENT;
+    if (!verifier || !headers || !solutions || !solution_lens || !results ||
+            !AllSet(headers, count) || !AllSet(solutions, count))
+        return EQUI_ERR_ARGUMENT;
+    return Guard([&]() -> int {
+        for (size_t i = 0; i < count; i++) {
+            SetResult(&results[i], verifier->verifier.Check(AsHeader(headers[i]),
+                                                            (const char*)solutions[i],
+                                                            solution_lens[i]));
+        }
+        return EQUI_OK;
+    });
+}
+
+int equi_prepare_job(equi_verifier* verifier, const char* job_id, size_t job_id_len,
+                     const unsigned char* header)
+{
+    if (!verifier || !job_id || !header)
+        return EQUI_ERR_ARGUMENT;
+    return Guard([&]() -> int {
+        verifier->verifier.PrepareJob(std::string(job_id, job_id_len), AsHeader(header));
+        return EQUI_OK;
+    });
+}
+
+int equi_check_job(const equi_verifier* verifier, const char* job_id,
+                   size_t job_id_len, const unsigned char* nonce,
+                   const unsigned char* solution, size_t solution_len,
+                   equi_result* result)
+{
+    return equi_check_job_batch(verifier, job_id, job_id_len, &nonce, &solution,
+                                &solution_len, 1, result);
+}
+
+int equi_check_job_batch(const equi_verifier* verifier, const char* job_id,
+                         size_t job_id_len, const unsigned char* const* nonces,
+                         const unsigned char* const* solutions,
+                         const size_t* solution_lens, size_t count,
+                         equi_result* results)
+{
+    if (!verifier || !job_id)
+        return EQUI_ERR_ARGUMENT;
+    if (count > 0 && (!nonces || !solutions || !solution_lens || !results ||
+                      !AllSet(nonces, count) || !AllSet(solutions, count)))
+        return EQUI_ERR_ARGUMENT;
+    return Guard([&]() -> int {
+        // Looked up once, so a job evicted halfway through still serves
+        // the whole batch.
+        EhMidstate midstate = verifier->verifier.FindJob(std::string(job_id, job_id_len));
+        if (!midstate)
+            return EQUI_ERR_UNKNOWN_JOB;
+        for (size_t i = 0; i < count; i++) {
+            SetResult(&results[i], verifier->verifier.CheckNonce(midstate, nonces[i],
+                                                                 (const char*)solutions[i],
+                                                                 solution_lens[i]));
+        }
+        return EQUI_OK;
+    });
+}
+
+int equi_remove_job(equi_verifier* verifier, const char* job_id, size_t job_id_len)
+{
+    if (!verifier || !job_id)
+        return EQUI_ERR_ARGUMENT;
+    return Guard([&]() -> int {
+        verifier->verifier.RemoveJob(std::string(job_id, job_id_len));
+        return EQUI_OK;
+    });
+}
+
+int equi_clear_jobs(equi_verifier* verifier)
+{
+    if (!verifier)
+        return EQUI_ERR_ARGUMENT;
+    return Guard([&]() -> int {
+        verifier->verifier.ClearJobs();
+        return EQUI_OK;
+    });
+}
+
+int equi_get_stats(const equi_verifier* verifier, equi_stats* stats)
+{
+    if (!verifier || !stats)
+        return EQUI_ERR_ARGUMENT;
+    const EhStats& counters = verifier->verifier.Stats();
+    stats->hashes_computed = counters.hashesComputed.load(std::memory_order_relaxed);
+    stats->hashes_saved = counters.hashesSaved.load(std::memory_order_relaxed);
+    for (size_t reason = 0; reason < EhReasonCount; reason++)
+        stats->results[reason] = counters.results[reason].load(std::memory_order_relaxed);
+    for (size_t round = 0; round < EhMaxK; round++)
+        stats->collision_rounds[round] = counters.collisionRounds[round].load(std::memory_order_relaxed);
+    stats->duplicates = counters.duplicates.load(std::memory_order_relaxed);
+    return EQUI_OK;
+}
@@ -0,0 +1,160 @@
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef LIBEQUI_H_INCLUDED
+#define LIBEQUI_H_INCLUDED
+
+// C interface to the verifier, for servers that link it in-process instead
+// of going through the Node addon. Build and install it with
+// src/equi/Makefile, then compile against `pkg-config --cflags --libs
+// libequi`.
+//
+// A verifier checks shares of one parameter set under one personalization.
+// Verifiers are opaque and every call may be made from any number of
+// threads at once, except equi_verifier_free, which must come after all
+// other calls on that verifier. Functions return EQUI_OK or a negative
+// equi_status. The verdict on a share is reported in an equi_result, so an
+// invalid share is not an error.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// EQUI_ABI_VERSION changes with every incompatible change to this header
+// and is the version in the shared library's soname (libequi.so.1).
+#define EQUI_VERSION_MAJOR 1
+#define EQUI_VERSION_MINOR 0
+#define EQUI_VERSION_PATCH 0
+#define EQUI_ABI_VERSION 1
+
+#if defined(__GNUC__)
+#define EQUI_API __attribute__((visibility("default")))
+#else
+#define EQUI_API
+#endif
+
+enum {
+    EQUI_HEADER_BYTES = 140,
+    EQUI_NONCE_BYTES = 32,
+    EQUI_HASH_BYTES = 32,
+    EQUI_PERSONALIZATION_MAX = 8,
+    EQUI_MAX_K = 16
+};
+
+typedef enum equi_status {
+    EQUI_OK = 0,
+    EQUI_ERR_ARGUMENT = -1,     // A NULL pointer or a value out of range.
+    EQUI_ERR_PARAMETERS = -2,   // (n, k) is not compiled into the library.
+    EQUI_ERR_NO_MEMORY = -3,
+    EQUI_ERR_UNKNOWN_JOB = -4,  // Never prepared, removed or evicted.
+    EQUI_ERR_INTERNAL = -5
+} equi_status;
+
+// Why a share was accepted or rejected, in the order the checks run. The
+// values and names match the reasons of the Node binding.
+typedef enum equi_reason {
+    EQUI_VALID = 0,
+    EQUI_BAD_LENGTH = 1,
+    EQUI_ABOVE_TARGET = 2,
+    EQUI_INDEX_ORDER = 3,
+    EQUI_DUPLICATE_INDEX = 4,
+    EQUI_COLLISION = 5,
+    EQUI_NONZERO_FINAL = 6,
+    EQUI_REASON_COUNT = 7
+} equi_reason;
+
+typedef struct equi_result {
+    int32_t reason;      // An equi_reason.
+    uint32_t round;      // Round of an EQUI_COLLISION failure, from 0.
+    uint32_t duplicate;  // 1 when the verdict came from the share cache.
+} equi_result;
+
+typedef struct equi_stats {
+    uint64_t hashes_computed;
+    uint64_t hashes_saved;
+    uint64_t results[EQUI_REASON_COUNT];
+    uint64_t collision_rounds[EQUI_MAX_K];
+    uint64_t duplicates;
+} equi_stats;
+
+typedef struct equi_verifier equi_verifier;
+
+// EQUI_ABI_VERSION of the library loaded at run time, to compare with the
+// one the caller was compiled against.
+EQUI_API unsigned int equi_abi_version(void);
+// "MAJOR.MINOR.PATCH".
+EQUI_API const char* equi_version(void);
+// Never NULL; unknown values get a generic string.
+EQUI_API const char* equi_status_string(int status);
+// "valid", "badLength", ...; NULL for an unknown value.
+EQUI_API const char* equi_reason_string(int reason);
+// Name of the leaf hash backend in use: "scalar", "sse4.1", "avx2" or
+// "avx512". EQUIHASHVERIFY_BACKEND overrides the choice as in the addon.
+EQUI_API const char* equi_backend(void);
+
+// Solution size of (n, k) in bytes, or 0 if it is not compiled in.
+EQUI_API size_t equi_solution_size(unsigned int n, unsigned int k);
+
+// personalization is a NUL-terminated tag of 1 to EQUI_PERSONALIZATION_MAX
+// bytes, or NULL for "ZcashPoW". cache_entries sizes the cache that flags
+// resubmitted shares; 0 disables it.
+EQUI_API int equi_verifier_new(unsigned int n, unsigned int k, const char* personalization,
+                               size_t cache_entries, equi_verifier** verifier);
+// Accepts NULL.
+EQUI_API void equi_verifier_free(equi_verifier* verifier);
+EQUI_API size_t equi_verifier_solution_size(const equi_verifier* verifier);
+
+// header is EQUI_HEADER_BYTES long. A solution of the wrong length is
+// reported as EQUI_BAD_LENGTH.
+EQUI_API int equi_check(const equi_verifier* verifier, const unsigned char* header,
+                        const unsigned char* solution, size_t solution_len,
+                        equi_result* result);
+// Compares the block hash with target, both little-endian 256-bit numbers
+// of EQUI_HASH_BYTES, before running Equihash: a hash above target is
+// EQUI_ABOVE_TARGET. hash may be NULL; otherwise it receives the block
+// hash, unless the solution has the wrong length.
+EQUI_API int equi_check_share(const equi_verifier* verifier, const unsigned char* header,
+                              const unsigned char* solution, size_t solution_len,
+                              const unsigned char* target, unsigned char* hash,
+                              equi_result* result);
+// Checks count shares in the calling thread, writing results[i] for share
+// i. Nothing is checked if any pointer is NULL. One call per batch keeps
+// the cost of crossing into C (cgo, FFI) off every share.
+EQUI_API int equi_check_batch(const equi_verifier* verifier,
+                              const unsigned char* const* headers,
+                              const unsigned char* const* solutions,
+                              const size_t* solution_lens, size_t count,
+                              equi_result* results);
+
+// Jobs cache the BLAKE2b state after the first 108 header bytes, which all
+// shares of a job share, so that their checks only absorb the nonce. The
+// most recent 16 jobs are kept; preparing a job again replaces it.
+EQUI_API int equi_prepare_job(equi_verifier* verifier, const char* job_id, size_t job_id_len,
+                              const unsigned char* header);
+// nonce is EQUI_NONCE_BYTES long.
+EQUI_API int equi_check_job(const equi_verifier* verifier, const char* job_id,
+                            size_t job_id_len, const unsigned char* nonce,
+                            const unsigned char* solution, size_t solution_len,
+                            equi_result* result);
+EQUI_API int equi_check_job_batch(const equi_verifier* verifier, const char* job_id,
+                                  size_t job_id_len, const unsigned char* const* nonces,
+                                  const unsigned char* const* solutions,
+                                  const size_t* solution_lens, size_t count,
+                                  equi_result* results);
+// Removing a job that is not cached is not an error.
+EQUI_API int equi_remove_job(equi_verifier* verifier, const char* job_id, size_t job_id_len);
+// Also forgets every cached share.
+EQUI_API int equi_clear_jobs(equi_verifier* verifier);
+
+// Counters of every share checked through verifier, as in the addon's
+// stats().
+EQUI_API int equi_get_stats(const equi_verifier* verifier, equi_stats* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
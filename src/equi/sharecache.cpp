@@ -0,0 +1,233 @@
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "sharecache.h"
+
+#include <cstring>
+#include <endian.h>
+#include <random>
+
+namespace {
+
+inline uint64_t rotl64(uint64_t x, unsigned int n)
+{
+    return (x << n) | (x >> (64 - n));
+}
+
+// SipHash-1-3, fed incrementally so a share need not be contiguous.
+class SipHash
+{
+    uint64_t v[4];
+    uint64_t tail;
+    size_t total;
+
+    void Round()
+    {
+        v[0] += v[1]; v[1] = rotl64(v[1], 13); v[1] ^= v[0]; v[0] = rotl64(v[0], 32);
+        v[2] += v[3]; v[3] = rotl64(v[3], 16); v[3] ^= v[2];
+        v[0] += v[3]; v[3] = rotl64(v[3], 21); v[3] ^= v[0];
+        v[2] += v[1]; v[1] = rotl64(v[1], 17); v[1] ^= v[2]; v[2] = rotl64(v[2], 32);
+    }
+
+    void Block(uint64_t m)
+    {
+        v[3] ^= m;
+        Round();
+        v[0] ^= m;
+    }
+
+public:
+    explicit SipHash(const uint64_t key[2]) : tail {0}, total {0}
+    {
+        v[0] = key[0] ^ 0x736f6d6570736575ULL;
+        v[1] = key[1] ^ 0x646f72616e646f6dULL;
+        v[2] = key[0] ^ 0x6c7967656e657261ULL;
+        v[3] = key[1] ^ 0x7465646279746573ULL;
+    }
+
+    void Update(const unsigned char* in, size_t len)
+    {
+        while (len > 0 && total % 8 != 0) {
+            tail |= uint64_t(*in++) << (8 * (total++ % 8));
+            len--;
+            if (total % 8 == 0) {
+                Block(tail);
+                tail = 0;
+            }
+        }
+        for (; len >= 8; in += 8, len -= 8, total += 8) {
+            uint64_t m;
+            memcpy(&m, in, sizeof(m));
+            Block(le64toh(m));
+        }
+        for (; len > 0; len--)
+            tail |= uint64_t(*in++) << (8 * (total++ % 8));
+    }
+
+    uint64_t Final()
+    {
+        Block(tail | (uint64_t(total) << 56));
+        v[2] ^= 0xff;
+        Round();
+        Round();
+        Round();
+        return v[0] ^ v[1] ^ v[2] ^ v[3];
+    }
+};
+
+} // namespace
+
+struct EhShareCache::Entry {
+    uint64_t hash;
+    uint64_t tick;      // Last use within the stripe; 0 for an empty entry.
+    EhMidstate scope;
+    size_t prefixLen;
+    EhResult result;
+};
+
+struct EhShareCache::Stripe {
+    std::mutex lock;
+    uint64_t tick;
+    std::unique_ptr<Entry[]> entries;
+    std::unique_ptr<unsigned char[]> bytes;
+
+    Stripe() : tick {0} { }
+};
+
+EhShareCache::EhShareCache(size_t entries, size_t maxPrefixLen, size_t solnLen) :
+        sets {entries > Stripes*Ways ? entries / (Stripes*Ways) : 1},
+        entryBytes {maxPrefixLen + solnLen},
+        stripes {new Stripe[Stripes]}
+{
+    std::random_device random;
+    for (auto& word : key)
+        word = (uint64_t(random()) << 32) | random();
+}
+
+EhShareCache::~EhShareCache() { }
+
+void EhShareCache::MakeKey(EhShareKey& key, const EhMidstate& scope,
+                           const unsigned char* prefix, size_t prefixLen,
+                           const unsigned char* soln, size_t solnLen) const
+{
+    key.scope = scope;
+    key.prefix = prefix;
+    key.prefixLen = prefixLen;
+    key.soln = soln;
+    key.solnLen = solnLen;
+
+    SipHash hash(this->key);
+    uint64_t id = htole64(reinterpret_cast<uintptr_t>(scope.get()));
+    hash.Update(reinterpret_cast<const unsigned char*>(&id), sizeof(id));
+    hash.Update(prefix, prefixLen);
+    hash.Update(soln, solnLen);
+    key.hash = hash.Final();
+}
+
+EhShareCache::Stripe& EhShareCache::StripeOf(const EhShareKey& key) const
+{
+    return stripes[key.hash % Stripes];
+}
+
+EhShareCache::Entry* EhShareCache::Lookup(Stripe& stripe, const EhShareKey& key) const
+{
+    if (!stripe.entries)
+        return NULL;
+    size_t first = (key.hash / Stripes) % sets * Ways;
+    for (size_t i = first; i < first + Ways; i++) {
+        Entry& entry = stripe.entries[i];
+        if (entry.tick == 0 || entry.hash != key.hash || entry.scope != key.scope ||
+                entry.prefixLen != key.prefixLen)
+            continue;
+        const unsigned char* bytes = stripe.bytes.get() + i*entryBytes;
+        if (memcmp(bytes, key.prefix, key.prefixLen) == 0 &&
+                memcmp(bytes + key.prefixLen, key.soln, key.solnLen) == 0)
+            return &entry;
+    }
+    return NULL;
+}
+
+bool EhShareCache::Find(const EhShareKey& key, EhResult& result) const
+{
+    if (key.prefixLen + key.solnLen > entryBytes)
+        return false;
+
+    Stripe& stripe = StripeOf(key);
+    std::lock_guard<std::mutex> guard(stripe.lock);
+    Entry* entry = Lookup(stripe, key);
+    if (entry == NULL)
+        return false;
+    entry->tick = ++stripe.tick;
+    result = entry->result;
+    return true;
+}
+
+bool EhShareCache::Insert(const EhShareKey& key, EhResult& result)
+{
+    if (key.prefixLen + key.solnLen > entryBytes)
+        return true;
+
+    Stripe& stripe = StripeOf(key);
+    std::lock_guard<std::mutex> guard(stripe.lock);
+    Entry* entry = Lookup(stripe, key);
+    if (entry != NULL) {
+        result = entry->result;
+        return false;
+    }
+
+    if (!stripe.entries) {
+        stripe.entries.reset(new Entry[sets*Ways]());
+        stripe.bytes.reset(new unsigned char[sets*Ways*entryBytes]);
+    }
+
+    // An empty entry has tick 0, so the oldest entry is also the first free
+    // one.
+    size_t first = (key.hash / Stripes) % sets * Ways;
+    size_t victim = first;
+    for (size_t i = first + 1; i < first + Ways; i++) {
+        if (stripe.entries[i].tick < stripe.entries[victim].tick)
+            victim = i;
+    }
+
+    entry = &stripe.entries[victim];
+    entry->hash = key.hash;
+    entry->tick = ++stripe.tick;
+    entry->scope = key.scope;
+    entry->prefixLen = key.prefixLen;
+    entry->result = result;
+    unsigned char* bytes = stripe.bytes.get() + victim*entryBytes;
+    memcpy(bytes, key.prefix, key.prefixLen);
+    memcpy(bytes + key.prefixLen, key.soln, key.solnLen);
+    return true;
+}
+
+void EhShareCache::Evict(const eh_HashState* scope)
+{
+    for (size_t s = 0; s < Stripes; s++) {
+        Stripe& stripe = stripes[s];
+        std::lock_guard<std::mutex> guard(stripe.lock);
+        if (!stripe.entries)
+            continue;
+        for (size_t i = 0; i < sets*Ways; i++) {
+            Entry& entry = stripe.entries[i];
+            if (entry.tick != 0 && entry.scope.get() == scope) {
+                entry.tick = 0;
+                entry.scope.reset();
+            }
+        }
+    }
+}
+
+void EhShareCache::Clear()
+{
+    for (size_t s = 0; s < Stripes; s++) {
+        Stripe& stripe = stripes[s];
+        std::lock_guard<std::mutex> guard(stripe.lock);
+        if (!stripe.entries)
+            continue;
+        for (size_t i = 0; i < sets*Ways; i++) {
+            stripe.entries[i].tick = 0;
+            stripe.entries[i].scope.reset();
+        }
+    }
+}
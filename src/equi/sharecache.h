@@ -0,0 +1,78 @@
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SHARECACHE_H_INCLUDED
+#define SHARECACHE_H_INCLUDED
+
+#include "equi.h"
+
+#include <memory>
+#include <mutex>
+
+// BLAKE2b state after absorbing the fixed part of a job's header, i.e.
+// everything before the nonce.
+typedef std::shared_ptr<const eh_HashState> EhMidstate;
+
+// A share as the cache sees it: the full header, or just the nonce for a
+// share of a prepared job, followed by the solution. Shares of a job are
+// scoped by its midstate, so the same nonce and solution under two jobs are
+// different shares.
+struct EhShareKey {
+    EhMidstate scope;
+    const unsigned char* prefix;
+    size_t prefixLen;
+    const unsigned char* soln;
+    size_t solnLen;
+    uint64_t hash;
+};
+
+// Bounded cache of verdicts for shares already checked, so that replaying a
+// share costs a keyed hash and a compare instead of a verification. Entries
+// keep the share bytes, so a hit is never a hash collision, and the keyed
+// hash keeps submitters from aiming their shares at a single set.
+//
+// The cache is split into stripes with a lock each; within a stripe a share
+// lives in one set of Ways entries and replaces the oldest entry there.
+// Stripes allocate their storage on first use.
+class EhShareCache
+{
+public:
+    enum : size_t { Stripes=16 };
+    enum : size_t { Ways=4 };
+
+    // Holds about entries shares of at most maxPrefixLen+solnLen bytes.
+    EhShareCache(size_t entries, size_t maxPrefixLen, size_t solnLen);
+    ~EhShareCache();
+
+    EhShareCache(const EhShareCache&) = delete;
+    EhShareCache& operator=(const EhShareCache&) = delete;
+
+    // Fills in key, hashing its bytes.
+    void MakeKey(EhShareKey& key, const EhMidstate& scope,
+                 const unsigned char* prefix, size_t prefixLen,
+                 const unsigned char* soln, size_t solnLen) const;
+
+    // Returns true and sets result if the share is cached.
+    bool Find(const EhShareKey& key, EhResult& result) const;
+    // Caches the verdict of a share. If another thread cached the same share
+    // in the meantime, returns false and sets result to its verdict.
+    bool Insert(const EhShareKey& key, EhResult& result);
+
+    // Drops the shares of one job, or every share.
+    void Evict(const eh_HashState* scope);
+    void Clear();
+
+private:
+    struct Entry;
+    struct Stripe;
+
+    size_t sets;
+    size_t entryBytes;
+    uint64_t key[2];
+    std::unique_ptr<Stripe[]> stripes;
+
+    Stripe& StripeOf(const EhShareKey& key) const;
+    Entry* Lookup(Stripe& stripe, const EhShareKey& key) const;
+};
+
+#endif
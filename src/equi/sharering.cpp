@@ -0,0 +1,191 @@
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "sharering.h"
+
+#include <cstring>
+#include <thread>
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t) &&
+              alignof(std::atomic<uint32_t>) == alignof(uint32_t),
+              "ring words are plain 32-bit integers to the producers");
+
+static uint32_t ReadWord(const unsigned char *p)
+{
+    uint32_t word;
+    memcpy(&word, p, sizeof(word));
+    return word;
+}
+
+static void WriteWord(unsigned char *p, uint32_t word)
+{
+    memcpy(p, &word, sizeof(word));
+}
+
+size_t EhShareRing::SlotBytes(size_t solutionSize)
+{
+    // Whole cache lines, so that neighbouring slots do not share one.
+    return (SlotHeaderBytes + sizeof(CBlockHeader) + solutionSize + 63) & ~size_t(63);
+}
+
+size_t EhShareRing::Bytes(size_t slots, size_t solutionSize)
+{
+    return ControlBytes + slots*(SlotBytes(solutionSize) + ResultBytes);
+}
+
+EhShareRing::EhShareRing(std::shared_ptr<const EhVerifier> verifier, unsigned char *memory,
+                         size_t slots, uint32_t id, WorkerPool& pool, std::function<void()> signal) :
+        verifier {verifier},
+        memory {memory},
+        slots {slots},
+        slotBytes {SlotBytes(verifier->Parameters().solutionSize)},
+        pool (pool),
+        signal {signal},
+        draining {0},
+        closed {false}
+{
+    memset(memory, 0, ControlBytes);
+    Word(Idle).store(1);
+    Word(Credits).store(slots);
+    Word(Id).store(id);
+    Word(SlotCount).store(slots);
+    Word(SlotSize).store(slotBytes);
+    Word(SolutionSize).store(verifier->Parameters().solutionSize);
+    for (uint32_t i = 0; i < slots; i++) {
+        SubmitSequence(i).store(i);
+        ResultSequence(i).store(i);
+    }
+}
+
+EhShareRing::~EhShareRing()
+{
+    Close();
+}
+
+std::atomic<uint32_t>& EhShareRing::Word(size_t index) const
+{
+    return *reinterpret_cast<std::atomic<uint32_t>*>(memory + 4*index);
+}
+
+std::atomic<uint32_t>& EhShareRing::SubmitSequence(uint32_t position) const
+{
+    unsigned char *slot = memory + ControlBytes + (position & (slots - 1))*slotBytes;
+    return *reinterpret_cast<std::atomic<uint32_t>*>(slot);
+}
+
+std::atomic<uint32_t>& EhShareRing::ResultSequence(uint32_t position) const
+{
+    unsigned char *slot = memory + ControlBytes + slots*slotBytes + (position & (slots - 1))*ResultBytes;
+    return *reinterpret_cast<std::atomic<uint32_t>*>(slot);
+}
+
+// A slot holds position once it is free for that position and position + 1
+// once the share at that position has been published.
+bool EhShareRing::Take(uint32_t& position)
+{
+    uint32_t head = Word(SubmitHead).load(std::memory_order_relaxed);
+    for (;;) {
+        int32_t diff = int32_t(SubmitSequence(head).load(std::memory_order_acquire) - (head + 1));
+        if (diff < 0)
+            return false;
+        if (diff == 0 && Word(SubmitHead).compare_exchange_weak(head, head + 1, std::memory_order_relaxed)) {
+            position = head;
+            return true;
+        }
+        if (diff > 0)
+            head = Word(SubmitHead).load(std::memory_order_relaxed);
+    }
+}
+
+void EhShareRing::Publish(uint32_t tag, const EhResult& result)
+{
+    uint32_t tail = Word(ResultTail).load(std::memory_order_relaxed);
+    for (;;) {
+        int32_t diff = int32_t(ResultSequence(tail).load(std::memory_order_acquire) - tail);
+        if (diff == 0 && Word(ResultTail).compare_exchange_weak(tail, tail + 1, std::memory_order_relaxed))
+            break;
+        if (diff < 0) {
+            // Only producers that skip Credits get here.
+            if (closed)
+                return;
+            std::this_thread::yield();
+        }
+        if (diff != 0)
+            tail = Word(ResultTail).load(std::memory_order_relaxed);
+    }
+
+    unsigned char *slot = reinterpret_cast<unsigned char*>(&ResultSequence(tail));
+    WriteWord(slot + 4, tag);
+    slot[8] = result.reason;
+    slot[9] = result.round;
+    slot[10] = result.duplicate;
+    ResultSequence(tail).store(tail + 1, std::memory_order_release);
+
+    if (Word(Signalled).exchange(1) == 0)
+        signal();
+}
+
+bool EhShareRing::Spawn()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (closed || draining >= pool.Size())
+        return false;
+    draining++;
+    pool.Submit([this] { Drain(); });
+    return true;
+}
+
+void EhShareRing::Kick()
+{
+    Spawn();
+}
+
+void EhShareRing::Drain()
+{
+    const size_t solutionSize = verifier->Parameters().solutionSize;
+    for (;;) {
+        uint32_t position;
+        while (!closed && Take(position)) {
+            // Hand what is left to another worker while this one verifies.
+            if (int32_t(SubmitSequence(position + 1).load(std::memory_order_relaxed) - (position + 2)) == 0)
+                Spawn();
+
+            unsigned char *slot = reinterpret_cast<unsigned char*>(&SubmitSequence(position));
+            uint32_t tag = ReadWord(slot + 4);
+            size_t solutionLength = ReadWord(slot + 8);
+            const CBlockHeader *header = reinterpret_cast<const CBlockHeader*>(slot + SlotHeaderBytes);
+            const char *solution = reinterpret_cast<const char*>(slot + SlotHeaderBytes + sizeof(CBlockHeader));
+            EhResult result = solutionLength > solutionSize ? EhResult(EhBadLength) :
+                              verifier->Check(header, solution, solutionLength);
+
+            SubmitSequence(position).store(position + slots, std::memory_order_release);
+            Publish(tag, result);
+        }
+
+        // The last worker out marks the ring idle and then looks again, as
+        // a producer may have published after the ring looked empty but
+        // before it saw Idle.
+        std::lock_guard<std::mutex> guard(lock);
+        if (--draining > 0)
+            return;
+        if (!closed) {
+            Word(Idle).store(1);
+            uint32_t head = Word(SubmitHead).load();
+            uint32_t busy = 1;
+            if (int32_t(SubmitSequence(head).load() - (head + 1)) >= 0 &&
+                    Word(Idle).compare_exchange_strong(busy, 0)) {
+                draining++;
+                continue;
+            }
+        }
+        idle.notify_all();
+        return;
+    }
+}
+
+void EhShareRing::Close()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    closed = true;
+    idle.wait(guard, [this] { return draining == 0; });
+}
@@ -0,0 +1,96 @@
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SHARERING_H_INCLUDED
+#define SHARERING_H_INCLUDED
+
+#include "verifier.h"
+#include "workerpool.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+// Submission and result rings in memory shared with the producers, such as
+// a SharedArrayBuffer, so that handing over a share costs a copy and a few
+// atomic operations instead of a call per share. sharering.js implements
+// the other side of this layout, in native byte order as JavaScript's
+// Atomics use it:
+//
+//   control block, ControlBytes long, made of 32-bit words: the ring
+//   counters below, each on a cache line of its own, then the ring's id,
+//   slot count, slot size and solution size
+//   Slots() submission slots of SlotBytes(): sequence, tag, solution
+//   length, 4 bytes unused, the 140-byte header and the solution
+//   Slots() result slots of ResultBytes: sequence, tag, then one byte each
+//   for the reason, the round and the duplicate flag
+//
+// Both rings are bounded queues with a sequence number per slot, so that
+// several threads may produce and consume on either side. A producer takes
+// one of Credits before submitting and a consumer returns it after reading
+// the result, which keeps the result ring from filling up.
+//
+// Producers set Idle to 0 with a compare-and-swap after publishing a share
+// and call Kick() when it was 1: the ring then drains on the pool until it
+// is empty and sets Idle again. After publishing results the ring calls
+// signal, once until the consumer clears Signalled.
+class EhShareRing
+{
+public:
+    enum : size_t {
+        SubmitTail=0, SubmitHead=16, ResultTail=32, ResultHead=48,
+        Idle=64, Signalled=80, Credits=96,
+        Id=112, SlotCount=113, SlotSize=114, SolutionSize=115,
+    };
+    enum : size_t { ControlBytes=512 };
+    enum : size_t { SlotHeaderBytes=16 };
+    enum : size_t { ResultBytes=16 };
+    enum : size_t { MaxSlots=1 << 20 };
+
+    static size_t SlotBytes(size_t solutionSize);
+    static size_t Bytes(size_t slots, size_t solutionSize);
+
+    // memory holds Bytes(slots, verifier's solution size) bytes, slots is a
+    // power of two up to MaxSlots. The constructor lays out the rings; it
+    // must outlive Close().
+    EhShareRing(std::shared_ptr<const EhVerifier> verifier, unsigned char *memory,
+                size_t slots, uint32_t id, WorkerPool& pool, std::function<void()> signal);
+    ~EhShareRing();
+
+    EhShareRing(const EhShareRing&) = delete;
+    EhShareRing& operator=(const EhShareRing&) = delete;
+
+    size_t Slots() const { return slots; }
+
+    // Starts draining the submission ring, up to one thread per worker.
+    void Kick();
+    // Stops draining after the shares being checked and waits for them;
+    // later shares are left in the ring.
+    void Close();
+
+private:
+    std::shared_ptr<const EhVerifier> verifier;
+    unsigned char *memory;
+    size_t slots;
+    size_t slotBytes;
+    WorkerPool& pool;
+    std::function<void()> signal;
+
+    std::mutex lock;
+    std::condition_variable idle;
+    size_t draining;
+    std::atomic<bool> closed;
+
+    std::atomic<uint32_t>& Word(size_t index) const;
+    std::atomic<uint32_t>& SubmitSequence(uint32_t position) const;
+    std::atomic<uint32_t>& ResultSequence(uint32_t position) const;
+
+    bool Take(uint32_t& position);
+    void Publish(uint32_t tag, const EhResult& result);
+    bool Spawn();
+    void Drain();
+};
+
+#endif
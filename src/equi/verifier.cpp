@@ -0,0 +1,188 @@
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "verifier.h"
+
+EhVerifier::EhVerifier(const EhParameters& p, const std::string& personal,
+                       size_t cacheEntries) :
+        params {p}
+{
+    assert(personal.size() <= EhPersonalizationLength);
+    memset(personalization, 0, EhPersonalizationLength);
+    memcpy(personalization, personal.data(), personal.size());
+    params.initialiseState(initialState, personalization);
+    if (cacheEntries > 0)
+        cache.reset(new EhShareCache(cacheEntries, sizeof(CBlockHeader), params.solutionSize));
+}
+
+std::string EhVerifier::Personalization() const
+{
+    size_t len = 0;
+    while (len < EhPersonalizationLength && personalization[len] != 0)
+        len++;
+    return std::string(personalization, len);
+}
+
+// Looks a share up in the cache. On a miss key is left ready for Remember.
+bool EhVerifier::Recall(EhShareKey& key, const EhMidstate& scope, const void *prefix,
+                        size_t prefixLen, const char *soln, EhResult& result) const
+{
+    if (!cache)
+        return false;
+    cache->MakeKey(key, scope, (const unsigned char*)prefix, prefixLen,
+                   (const unsigned char*)soln, params.solutionSize);
+    if (!cache->Find(key, result))
+        return false;
+    result.duplicate = true;
+    return true;
+}
+
+// Caches the verdict of a share Recall missed. When the same share was
+// checked concurrently and cached first, this one is the duplicate.
+void EhVerifier::Remember(const EhShareKey& key, EhResult& result) const
+{
+    if (cache && !cache->Insert(key, result))
+        result.duplicate = true;
+}
+
+void EhVerifier::DropJob(const EhMidstate& midstate)
+{
+    if (cache && midstate)
+        cache->Evict(midstate.get());
+}
+
+// The prepared job whose header prefix header has, if any.
+EhMidstate EhVerifier::JobOf(const CBlockHeader *header) const
+{
+    std::lock_guard<std::mutex> guard(jobsLock);
+    for (auto it = jobs.rbegin(); it != jobs.rend(); ++it) {
+        if (memcmp(&it->prefix, &header->data, sizeof(header->data)) == 0)
+            return it->midstate;
+    }
+    return EhMidstate();
+}
+
+EhResult EhVerifier::Check(const CBlockHeader *header, const char *soln, size_t solnLen) const
+{
+    EhResult result(EhBadLength);
+    EhShareKey key;
+    if (solnLen == params.solutionSize) {
+        // Keyed as CheckNonce keys the same share when it belongs to a job.
+        EhMidstate scope = cache ? JobOf(header) : EhMidstate();
+        bool cached = scope ?
+            Recall(key, scope, header->nNonce.begin(), sizeof(uint256), soln, result) :
+            Recall(key, scope, header, sizeof(CBlockHeader), soln, result);
+        if (!cached) {
+            eh_HashState state = initialState;
+            AbsorbHeader(state, header);
+            result = params.isValidSolution(state, (const unsigned char*)soln, &stats);
+            Remember(key, result);
+        }
+    }
+    stats.Record(result);
+    return result;
+}
+
+EhResult EhVerifier::CheckShare(const CBlockHeader *header, const char *soln, size_t solnLen,
+                                const unsigned char target[EhBlockHashLength],
+                                unsigned char hash[EhBlockHashLength]) const
+{
+    EhResult result(EhBadLength);
+    if (solnLen == params.solutionSize) {
+        EhBlockHash(header, soln, solnLen, hash);
+        if (EhHashMeetsTarget(hash, target))
+            return Check(header, soln, solnLen);
+        result = EhResult(EhAboveTarget);
+    }
+    stats.Record(result);
+    return result;
+}
+
+void EhVerifier::VerifyBatch(const CBlockHeader* const* headers, const char* const* solns,
+                             const size_t* solnLens, size_t count, uint8_t* results) const
+{
+    for (size_t i = 0; i < count; i++)
+        results[i] = Check(headers[i], solns[i], solnLens[i]).Valid() ? 1 : 0;
+}
+
+EhMidstate EhVerifier::PrepareJob(const std::string& jobId, const CBlockHeader *header)
+{
+    std::shared_ptr<eh_HashState> midstate = std::make_shared<eh_HashState>(initialState);
+    AbsorbHeaderPrefix(*midstate, header);
+
+    Job job;
+    job.id = jobId;
+    job.prefix = header->data;
+    job.midstate = midstate;
+    EhMidstate replaced, evicted;
+    {
+        std::lock_guard<std::mutex> guard(jobsLock);
+        for (auto it = jobs.begin(); it != jobs.end(); ++it) {
+            if (it->id == jobId) {
+                replaced = it->midstate;
+                jobs.erase(it);
+                break;
+            }
+        }
+        if (jobs.size() >= MaxJobs) {
+            evicted = jobs.front().midstate;
+            jobs.erase(jobs.begin());
+        }
+        jobs.push_back(job);
+    }
+    DropJob(replaced);
+    DropJob(evicted);
+    return midstate;
+}
+
+EhMidstate EhVerifier::FindJob(const std::string& jobId) const
+{
+    std::lock_guard<std::mutex> guard(jobsLock);
+    for (auto it = jobs.rbegin(); it != jobs.rend(); ++it) {
+        if (it->id == jobId)
+            return it->midstate;
+    }
+    return EhMidstate();
+}
+
+void EhVerifier::RemoveJob(const std::string& jobId)
+{
+    EhMidstate removed;
+    {
+        std::lock_guard<std::mutex> guard(jobsLock);
+        for (auto it = jobs.begin(); it != jobs.end(); ++it) {
+            if (it->id == jobId) {
+                removed = it->midstate;
+                jobs.erase(it);
+                break;
+            }
+        }
+    }
+    DropJob(removed);
+}
+
+void EhVerifier::ClearJobs()
+{
+    {
+        std::lock_guard<std::mutex> guard(jobsLock);
+        jobs.clear();
+    }
+    if (cache)
+        cache->Clear();
+}
+
+EhResult EhVerifier::CheckNonce(const EhMidstate& midstate, const unsigned char *nonce,
+                                const char *soln, size_t solnLen) const
+{
+    EhResult result(EhBadLength);
+    EhShareKey key;
+    if (solnLen == params.solutionSize &&
+            !Recall(key, midstate, nonce, sizeof(uint256), soln, result)) {
+        eh_HashState state = *midstate;
+        AbsorbNonce(state, nonce);
+        result = params.isValidSolution(state, (const unsigned char*)soln, &stats);
+        Remember(key, result);
+    }
+    stats.Record(result);
+    return result;
+}
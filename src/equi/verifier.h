@@ -0,0 +1,100 @@
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef VERIFIER_H_INCLUDED
+#define VERIFIER_H_INCLUDED
+
+#include "equi.h"
+#include "sharecache.h"
+
+#include <memory>
+#include <mutex>
+
+// Verifies solutions for one Equihash parameter set from the registry under
+// one personalization. The personalised BLAKE2b state is built once, when
+// the verifier is constructed, and copied for every share. Instances may be
+// shared between threads; the job cache is guarded by its own lock.
+//
+// With a share cache, a share submitted again gets the verdict of its first
+// check with EhResult::duplicate set. A share whose header starts like a
+// prepared job's is cached under that job, whether it came with its full
+// header or its nonce, so removing or replacing the job drops it. Shares of
+// headers that match no job stay until they age out of the cache, and
+// ClearJobs drops every cached share.
+class EhVerifier
+{
+private:
+    const EhParameters& params;
+    char personalization[EhPersonalizationLength];
+    eh_HashState initialState;
+
+    struct Job {
+        std::string id;
+        decltype(CBlockHeader::data) prefix;
+        EhMidstate midstate;
+    };
+    // Most recently prepared jobs, oldest first. Pools only keep a handful
+    // of jobs live, so a short vector beats a map here.
+    std::vector<Job> jobs;
+    mutable std::mutex jobsLock;
+
+    mutable EhStats stats;
+    std::unique_ptr<EhShareCache> cache;
+
+    bool Recall(EhShareKey& key, const EhMidstate& scope, const void *prefix,
+                size_t prefixLen, const char *soln, EhResult& result) const;
+    void Remember(const EhShareKey& key, EhResult& result) const;
+    void DropJob(const EhMidstate& midstate);
+    EhMidstate JobOf(const CBlockHeader *header) const;
+
+public:
+    // personalization is at most EhPersonalizationLength bytes; shorter
+    // tags are padded with zero bytes. cacheEntries of 0, the default,
+    // disables the share cache.
+    explicit EhVerifier(const EhParameters& p,
+                        const std::string& personal = DefaultPersonalization,
+                        size_t cacheEntries = 0);
+
+    const EhParameters& Parameters() const { return params; }
+    std::string Personalization() const;
+    const EhStats& Stats() const { return stats; }
+
+    // Checks a solution of solnLen bytes and records the outcome in Stats().
+    EhResult Check(const CBlockHeader *header, const char *soln, size_t solnLen) const;
+    // soln must hold Parameters().solutionSize bytes.
+    bool Verify(const CBlockHeader *header, const char *soln) const
+    {
+        return Check(header, soln, params.solutionSize).Valid();
+    }
+    // Checks a share against its target before its solution: hash receives
+    // the block hash (see EhBlockHash), and a hash above target fails with
+    // EhAboveTarget without running Equihash. hash is left untouched when
+    // the solution has the wrong length.
+    EhResult CheckShare(const CBlockHeader *header, const char *soln, size_t solnLen,
+                        const unsigned char target[EhBlockHashLength],
+                        unsigned char hash[EhBlockHashLength]) const;
+    // results[i] is 1 for a valid share and 0 otherwise.
+    void VerifyBatch(const CBlockHeader* const* headers, const char* const* solns,
+                     const size_t* solnLens, size_t count, uint8_t* results) const;
+
+    enum : size_t { MaxJobs=16 };
+
+    // Caches the midstate for jobId from header->data, replacing any
+    // previous entry and evicting the oldest job beyond MaxJobs.
+    EhMidstate PrepareJob(const std::string& jobId, const CBlockHeader *header);
+    // Returns an empty pointer if jobId is not cached.
+    EhMidstate FindJob(const std::string& jobId) const;
+    void RemoveJob(const std::string& jobId);
+    void ClearJobs();
+
+    // Checks a share of a prepared job, absorbing only the 32-byte nonce.
+    EhResult CheckNonce(const EhMidstate& midstate, const unsigned char *nonce,
+                        const char *soln, size_t solnLen) const;
+    bool VerifyNonce(const EhMidstate& midstate, const unsigned char *nonce,
+                     const char *soln) const
+    {
+        return CheckNonce(midstate, nonce, soln, params.solutionSize).Valid();
+    }
+};
+
+#endif
@@ -1,14 +1,92 @@
-var ev = require('bindings')('equihashverify.node');
+var assert = require('assert');
+var ev = require('./index.js');
 
-header = Buffer('000000206B0A233CC0AEA1DC012D9C1093CD9A3421F35034F7A832A4F4747CB12A000000512E047C946E6BB580FD678ACBA888107679347785DC16974CEA68B36228D1C10000000000000000000000000000000000000000000000000000000000000000E73DB25937EB6B1D30000AEF4C270000000000000000000000000001000000000000000000000000', 'hex');
-soln = Buffer('055831EBC1CD3D31F07EF29276927D79171BAA60D392F2BA0B5508DCA2CE11DD6D970D7F7568CF2130550444336C9D462EFEA83B73F685B4DC1D78C4BFCEC5AD665987B2', 'hex');
+var header = Buffer.from('000000206B0A233CC0AEA1DC012D9C1093CD9A3421F35034F7A832A4F4747CB12A000000512E047C946E6BB580FD678ACBA888107679347785DC16974CEA68B36228D1C10000000000000000000000000000000000000000000000000000000000000000E73DB25937EB6B1D30000AEF4C270000000000000000000000000001000000000000000000000000', 'hex');
+var soln = Buffer.from('055831EBC1CD3D31F07EF29276927D79171BAA60D392F2BA0B5508DCA2CE11DD6D970D7F7568CF2130550444336C9D462EFEA83B73F685B4DC1D78C4BFCEC5AD665987B2', 'hex');
 
+// The asynchronous checks below must all report back before exit.
+var pending = 0;
+function expectCall(fn) {
+	pending++;
+	return function () {
+		pending--;
+		return fn.apply(this, arguments);
+	};
+}
+process.on('exit', function (code) {
+	if (code === 0 && pending !== 0) {
+		console.error(pending + ' asynchronous checks never reported');
+		process.exitCode = 1;
+	}
+});
+process.on('unhandledRejection', function (err) {
+	throw err;
+});
 
-//var start = new Date().getTime();
+// The vector above is a 96,5 solution.
+var verifier = ev.createVerifier({n: 96, k: 5, cacheSize: 64});
 
-//for (i = 1; i <= 100000; i++)
-	//ev.verify(header, soln);
-	console.log(ev.verify(header, soln));
+assert.strictEqual(verifier.verify(header, soln), true);
 
-//var end = new Date().getTime();
-//console.log(end - start);
+assert.deepStrictEqual(Array.from(verifier.verifyBatch([header, header], [soln, soln])), [1, 1]);
+
+// Same solution under another chain's personalization must not verify.
+assert.strictEqual(ev.createVerifier({n: 96, k: 5, personalization: 'BgoldPoW'}).verify(header, soln), false);
+
+assert.strictEqual(verifier.check(header, soln.slice(1)).reason, 'badLength');
+assert.throws(function () { verifier.verify(header.slice(1), soln); }, RangeError);
+
+verifier.prepareJob('1', header);
+assert.strictEqual(verifier.verifyJob('1', header.slice(108), soln), true);
+
+// Rings only attach to shared memory, which cannot be detached under the
+// pool threads.
+assert.throws(function () {
+	verifier.attachShareRing(new Uint8Array(verifier.shareRingBytes(4)), 4, function () {});
+}, TypeError);
+
+// Without a cacheSize nothing is remembered.
+var uncached = ev.createVerifier({n: 96, k: 5});
+assert.strictEqual(uncached.check(header, soln).duplicate, false);
+assert.strictEqual(uncached.check(header, soln).duplicate, false);
+
+// A share checked with its full header belongs to the job its header
+// starts like, so removing the job forgets it.
+var scoped = ev.createVerifier({n: 96, k: 5, cacheSize: 64});
+scoped.prepareJob('a', header);
+assert.strictEqual(scoped.check(header, soln).duplicate, false);
+assert.strictEqual(scoped.check(header, soln).duplicate, true);
+scoped.removeJob('a');
+assert.strictEqual(scoped.check(header, soln).duplicate, false);
+
+// Shares of the wrong size get a verdict and the stream carries on.
+var badVerdicts = [];
+var badStream = ev.createVerifyStream({verifier: uncached});
+badStream.on('data', function (verdict) { badVerdicts.push(verdict); });
+badStream.on('end', expectCall(function () {
+	assert.deepStrictEqual(badVerdicts, [
+		{tag: 'shortHeader', valid: false, reason: 'badLength', duplicate: false},
+		{tag: 'shortSolution', valid: false, reason: 'badLength', duplicate: false},
+		{tag: 'share', valid: true, reason: 'valid', duplicate: false}
+	]);
+}));
+badStream.write({header: header.slice(1), solution: soln, tag: 'shortHeader'});
+badStream.write({header: header, solution: soln.slice(1), tag: 'shortSolution'});
+badStream.end({header: header, solution: soln, tag: 'share'});
+
+verifier.verifyAsync(header, soln).then(expectCall(function (result) {
+	assert.strictEqual(result, true);
+
+	// Checked above already, so the stream reports it as a duplicate.
+	var verdicts = [];
+	ev.createVerifyStream({verifier: verifier}).on('data', function (verdict) { verdicts.push(verdict); })
+		.on('end', expectCall(function () {
+			assert.deepStrictEqual(verdicts, [{tag: 'share', valid: true, reason: 'valid', duplicate: true}]);
+			var ring = ev.createShareRing({verifier: verifier, slots: 4, onResults: expectCall(function () {
+				assert.deepStrictEqual(ring.read(), [{tag: 7, valid: true, reason: 'valid', duplicate: true}]);
+				ring.close();
+			})});
+			assert.strictEqual(ring.submit(header, soln, 7), true);
+		}))
+		.end({header: header, solution: soln, tag: 'share'});
+}));
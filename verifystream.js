@@ -0,0 +1,157 @@
+var Duplex = require('stream').Duplex;
+var util = require('util');
+var ShareRing = require('./sharering.js');
+
+// Header size of every parameter set.
+var HEADER_BYTES = 140;
+
+// Object-mode stream of share verdicts. Each written record is
+// {header, solution, tag}; each verdict read is {tag, valid, reason,
+// duplicate}, in write order unless options.ordered is false. A header or
+// solution of the wrong size gets a badLength verdict like any other share;
+// only records without header and solution buffers fail the stream.
+//
+// Shares are copied into a share ring (see sharering.js) as they are
+// written, so a burst waits in the ring's shared memory rather than as
+// JavaScript callbacks, and the native pool is only called when it has
+// gone idle. The ring is attached on the first write and closed when the
+// stream ends or is destroyed; until then it keeps the event loop alive.
+//
+// At most highWaterMark shares are outstanding, counting verdicts that wait
+// for an earlier one in ordered mode, and the writable side stops accepting
+// records while that many are outstanding or the readable side is full. The
+// ring has at least that many slots, so a write always finds one free.
+function VerifyStream(verifier, options) {
+	var highWaterMark = options.highWaterMark || 64;
+	Duplex.call(this, {objectMode: true, highWaterMark: highWaterMark});
+	this._verifier = verifier;
+	this._ordered = options.ordered !== false;
+	this._limit = highWaterMark;
+	this._slots = 1;
+	while (this._slots < highWaterMark)
+		this._slots *= 2;
+	this._ring = null;
+	// Ring tags are indices into these, taken from _free while the share is
+	// in the ring.
+	this._seqs = new Array(this._slots);
+	this._tags = new Array(this._slots);
+	this._free = [];
+	for (var i = this._slots - 1; i >= 0; i--)
+		this._free.push(i);
+	this._outstanding = 0;
+	this._written = 0;
+	this._next = 0;
+	this._verdicts = {};
+	this._resume = null;
+	this._finish = null;
+	// False while the readable side is full, until the next _read.
+	this._wanted = true;
+}
+util.inherits(VerifyStream, Duplex);
+
+VerifyStream.prototype._write = function (record, encoding, callback) {
+	var seq = this._written;
+	if (!record || !Buffer.isBuffer(record.header) || !Buffer.isBuffer(record.solution)) {
+		callback(new TypeError('Records should have header and solution buffers.'));
+		return;
+	}
+	if (record.header.length !== HEADER_BYTES) {
+		// The ring only takes whole headers.
+		process.nextTick(badLength, this, seq, record.tag);
+	} else {
+		if (!this._ring) {
+			try {
+				this._ring = ShareRing.create(this._verifier, this._slots, onResults.bind(null, this));
+			} catch (err) {
+				callback(err);
+				return;
+			}
+		}
+		var index = this._free.pop();
+		this._seqs[index] = seq;
+		this._tags[index] = record.tag;
+		this._ring.submit(record.header, record.solution, index);
+	}
+	this._written++;
+	this._outstanding++;
+	this._resume = callback;
+	this._maybeResume();
+};
+
+function badLength(stream, seq, tag) {
+	stream._verdict(seq, {tag: tag, valid: false, reason: 'badLength', duplicate: false});
+}
+
+function onResults(stream, ring) {
+	var verdicts = ring.read();
+	for (var i = 0; i < verdicts.length; i++) {
+		var index = verdicts[i].tag;
+		var tag = stream._tags[index];
+		stream._tags[index] = undefined;
+		stream._free.push(index);
+		stream._verdict(stream._seqs[index], {tag: tag, valid: verdicts[i].valid,
+			reason: verdicts[i].reason, duplicate: verdicts[i].duplicate});
+	}
+}
+
+VerifyStream.prototype._verdict = function (seq, verdict) {
+	if (this.destroyed)
+		return;
+	if (!this._ordered) {
+		this._outstanding--;
+		this._wanted = this.push(verdict);
+	} else {
+		this._verdicts[seq] = verdict;
+		while (this._next in this._verdicts) {
+			verdict = this._verdicts[this._next];
+			delete this._verdicts[this._next++];
+			this._outstanding--;
+			this._wanted = this.push(verdict);
+		}
+	}
+	this._maybeResume();
+	if (this._finish && this._outstanding === 0) {
+		var finish = this._finish;
+		this._finish = null;
+		this._closeRing();
+		this.push(null);
+		finish();
+	}
+};
+
+VerifyStream.prototype._maybeResume = function () {
+	if (this._resume && this._outstanding < this._limit && this._wanted) {
+		var resume = this._resume;
+		this._resume = null;
+		resume();
+	}
+};
+
+VerifyStream.prototype._closeRing = function () {
+	if (this._ring) {
+		this._ring.close();
+		this._ring = null;
+	}
+};
+
+VerifyStream.prototype._read = function () {
+	this._wanted = true;
+	this._maybeResume();
+};
+
+VerifyStream.prototype._final = function (callback) {
+	if (this._outstanding === 0) {
+		this._closeRing();
+		this.push(null);
+		callback();
+	} else {
+		this._finish = callback;
+	}
+};
+
+VerifyStream.prototype._destroy = function (err, callback) {
+	this._closeRing();
+	callback(err);
+};
+
+module.exports = VerifyStream;